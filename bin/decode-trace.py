@@ -0,0 +1,300 @@
+#!/usr/bin/env python3
+"""Turn the binary trace records sent by a build with MT_TRACING back into log lines.
+
+The device sends only an ID for each d() or mt_log() call site plus the raw argument values. This
+finds the call sites in the library source, works out the same IDs for them, and formats each
+record with its site's format string. Anything else the sketch prints is passed through as is.
+
+    bin/decode-trace.py /dev/ttyUSB0 --baud 115200   (needs pyserial)
+    bin/decode-trace.py capture.bin
+    some-serial-tool | bin/decode-trace.py
+
+The source has to be the same as what's on the device, or some lines will come out wrong.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+MASK = 0xFFFFFFFF
+FNV_PRIME = 16777619
+FNV_OFFSET = 2166136261
+
+DROPPED_ID = 0
+
+TAG_UNSIGNED = 0x10
+TAG_SIGNED = 0x20
+TAG_FLOAT = 0x30
+TAG_STRING = 0x40
+TAG_POINTER = 0x50
+TAG_OTHER = 0x60
+
+
+def fnv(data, h=FNV_OFFSET):
+    for b in data:
+        h = ((h ^ b) * FNV_PRIME) & MASK
+    return h
+
+
+# Must match mt_trace_id() in src/mt_internals.h
+def trace_id(basename, line):
+    return fnv(bytes([line & 0xFF, (line >> 8) & 0xFF]), fnv(basename.encode()))
+
+
+def strip_comments(text):
+    """Blank out comments, keeping string literals and line numbers where they were."""
+    out = []
+    i = 0
+    n = len(text)
+    while i < n:
+        c = text[i]
+        if text.startswith('//', i):
+            j = text.find('\n', i)
+            j = n if j < 0 else j
+            out.append(' ' * (j - i))
+            i = j
+        elif text.startswith('/*', i):
+            j = text.find('*/', i + 2)
+            j = n if j < 0 else j + 2
+            out.append(re.sub(r'[^\n]', ' ', text[i:j]))
+            i = j
+        elif c in '"\'':
+            j = i + 1
+            while j < n and text[j] != c and text[j] != '\n':
+                j += 2 if text[j] == '\\' else 1
+            out.append(text[i:j + 1])
+            i = j + 1
+        else:
+            out.append(c)
+            i += 1
+    return ''.join(out)
+
+
+def blank_strings(text):
+    """Blank out the insides of string and char literals, so that calls can be found in code only."""
+    return re.sub(r'"(?:\\.|[^"\\\n])*"|\'(?:\\.|[^\'\\\n])*\'',
+                  lambda m: m.group(0)[0] + ' ' * (len(m.group(0)) - 2) + m.group(0)[-1], text)
+
+
+def unescape(s):
+    return s.encode('latin-1', 'backslashreplace').decode('unicode_escape')
+
+
+CALL = re.compile(r'(?<![\w.>])(?:d|mt_log)\s*\(')
+LITERAL = re.compile(r'\s*"((?:\\.|[^"\\\n])*)"')
+
+
+def find_sites(src_dir):
+    """Map trace IDs to (format, where) for every d() and mt_log() call in the source."""
+    sites = {}
+    for name in sorted(os.listdir(src_dir)):
+        if not name.endswith(('.cpp', '.c', '.h')):
+            continue
+        with open(os.path.join(src_dir, name), encoding='utf-8', errors='replace') as f:
+            text = strip_comments(f.read())
+        code = blank_strings(text)
+        for m in CALL.finditer(code):
+            # The format is one or more adjacent string literals
+            pos = m.end()
+            parts = []
+            while True:
+                lit = LITERAL.match(text, pos)
+                if not lit:
+                    break
+                parts.append(lit.group(1))
+                pos = lit.end()
+            if not parts:
+                continue  # Not a call with a format, e.g. a definition
+
+            # Find the closing paren, so that every line the call spans gets an ID. Compilers
+            # disagree over which of them __LINE__ means.
+            depth = 1
+            end = pos
+            while end < len(code) and depth > 0:
+                if code[end] == '(':
+                    depth += 1
+                elif code[end] == ')':
+                    depth -= 1
+                end += 1
+            first = text.count('\n', 0, m.start()) + 1
+            last = text.count('\n', 0, end) + 1
+
+            fmt = unescape(''.join(parts))
+            for line in range(first, last + 1):
+                tid = trace_id(name, line)
+                where = '%s:%d' % (name, first)
+                if tid in sites and sites[tid][1] != where:
+                    print('warning: %s and %s have the same trace ID %08x' % (sites[tid][1], where, tid),
+                          file=sys.stderr)
+                sites[tid] = (fmt, where)
+    return sites
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def parse_args(data):
+    args = []
+    i = 0
+    while i < len(data):
+        tag = data[i]
+        kind, size = tag & 0xF0, tag & 0x0F
+        i += 1
+        if kind == TAG_STRING:
+            if i >= len(data):
+                return None
+            size = data[i]
+            i += 1
+            args.append(data[i:i + size].decode('utf-8', 'replace'))
+        elif kind in (TAG_UNSIGNED, TAG_POINTER):
+            args.append(int.from_bytes(data[i:i + size], 'little'))
+        elif kind == TAG_SIGNED:
+            args.append(int.from_bytes(data[i:i + size], 'little', signed=True))
+        elif kind == TAG_OTHER:
+            args.append('?')
+        elif kind == TAG_FLOAT and size in (4, 8):
+            args.append(struct.unpack('<f' if size == 4 else '<d', data[i:i + size])[0])
+        else:
+            return None
+        if i + size > len(data):
+            return None
+        i += size
+    return args
+
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\d+|\*)?(\.\d+)?(?:hh|h|ll|l|L|z|j|t)?([diouxXeEfgGcsp%])')
+
+
+def format_line(fmt, args):
+    """Apply a C format to the decoded arguments, as near as Python's % operator can."""
+    def convert(m):
+        flags, width, prec, conv = m.groups()
+        if conv == '%':
+            return '%%'
+        if conv == 'p':
+            flags, conv = flags + '#', 'x'
+        elif conv == 'u':
+            conv = 'd'
+        return '%' + flags + (width or '') + (prec or '') + conv
+
+    pyfmt = CONVERSION.sub(convert, fmt)
+    try:
+        return pyfmt % tuple(args)
+    except (TypeError, ValueError):
+        # Too few arguments (a record cut short) or not the types the format expects
+        return '%s %r' % (fmt.rstrip('\r\n'), args)
+
+
+def decode_record(frame, sites):
+    body = cobs_decode(frame)
+    if body is None or len(body) < 5:
+        return None
+    check = 0
+    for b in body:
+        check ^= b
+    if check != 0:
+        return None
+    tid = int.from_bytes(body[:4], 'little')
+    args = parse_args(body[4:-1])
+    if args is None:
+        return None
+    if tid == DROPPED_ID:
+        return '[%s log lines dropped]' % (args[0] if args else '?')
+    if tid not in sites:
+        return '[unknown trace ID %08x] %r' % (tid, args)
+    return format_line(sites[tid][0], args).rstrip('\r\n')
+
+
+def is_text(data):
+    return all(b >= 0x20 or b in b'\t\r\n' for b in data)
+
+
+def decode_stream(read, write, sites):
+    text = bytearray()
+    frame = None  # Bytes of the record we're in the middle of, if we are
+
+    def flush_text():
+        if text:
+            write(text.decode('utf-8', 'replace'))
+            text.clear()
+
+    while True:
+        chunk = read()
+        if not chunk:
+            break
+        for b in chunk:
+            if frame is None:
+                if b == 0:
+                    frame = bytearray()
+                else:
+                    text.append(b)
+                    if b == 0x0A:
+                        flush_text()
+            elif b != 0:
+                frame.append(b)
+            elif frame:
+                line = decode_record(bytes(frame), sites)
+                if line is not None:
+                    flush_text()
+                    write(line + '\n')
+                    frame = None
+                else:
+                    # We must have come in partway through a record, so that was text, and this zero
+                    # starts a record
+                    if is_text(frame):
+                        text.extend(frame)
+                        flush_text()
+                    frame = bytearray()
+            # A zero right after another is the start of a record that follows the last one
+    flush_text()
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('input', nargs='?', help='serial port or capture file (default: stdin)')
+    parser.add_argument('--baud', type=int, default=9600, help='serial port speed (default: 9600)')
+    parser.add_argument('--src', action='append',
+                        help='directory of source the device was built from, may be repeated (default: ../src)')
+    args = parser.parse_args()
+
+    sites = {}
+    for src in args.src or [os.path.join(here, '..', 'src')]:
+        sites.update(find_sites(src))
+
+    if args.input is None:
+        stream = sys.stdin.buffer
+        read = lambda: stream.read1(256) if hasattr(stream, 'read1') else stream.read(256)
+    elif os.path.isfile(args.input):
+        stream = open(args.input, 'rb')
+        read = lambda: stream.read(256)
+    else:
+        import serial  # pyserial
+        stream = serial.Serial(args.input, args.baud)
+        read = lambda: stream.read(max(1, stream.in_waiting))
+
+    def write(s):
+        sys.stdout.write(s)
+        sys.stdout.flush()
+
+    try:
+        decode_stream(read, write, sites)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
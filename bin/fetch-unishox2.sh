@@ -0,0 +1,19 @@
+#!/usr/bin/env bash
+# Vendor unishox2 (Apache-2.0), the text compression the firmware uses on the compressed text port,
+# into src/, where the library picks it up as its default text codec. It's built to take the size
+# of its output buffer, so a long message can't overrun one.
+
+set -e
+
+UNISHOX2_REF=${UNISHOX2_REF:-master}
+base=https://raw.githubusercontent.com/siara-cc/Unishox2/$UNISHOX2_REF
+
+cd "$(dirname "$0")/../src"
+wget -q -O unishox2.c "$base/unishox2.c"
+wget -q -O unishox2.h "$base/unishox2.h"
+
+sed -i 's/^#\( *\)define UNISHOX_API_WITH_OUTPUT_LEN 0/#\1define UNISHOX_API_WITH_OUTPUT_LEN 1/' unishox2.h
+if ! grep -Eq '^# *define UNISHOX_API_WITH_OUTPUT_LEN 1' unishox2.h; then
+  echo "Couldn't turn on UNISHOX_API_WITH_OUTPUT_LEN in unishox2.h" >&2
+  exit 1
+fi
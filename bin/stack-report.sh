@@ -0,0 +1,42 @@
+#!/bin/sh
+# Report how much stack each of the library's functions takes on a target, as worked out by gcc's
+# -fstack-usage:
+#
+#   bin/stack-report.sh host                             the host's g++, against test/host/stub
+#   bin/stack-report.sh arduino:avr:mega [sketch_dir]    arduino-cli, for that board
+#
+# The figures are per function, not per call chain: the peak for a path is the sum of the
+# functions along it. "dynamic" means a frame that can grow at run time. They only hold for the
+# target they came from, so CI runs this for each board it builds for.
+set -e
+root=$(cd "$(dirname "$0")/.." && pwd)
+target=${1:?"usage: $0 host|<fqbn> [sketch_dir]"}
+sketch=${2:-$root/examples/SendReceiveClient}
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+if [ "$target" = host ]; then
+  for f in "$root"/src/*.cpp; do
+    g++ -std=gnu++11 -Os -fstack-usage -I"$root/test/host/stub" -I"$root/src" -w $CXXFLAGS \
+      -c "$f" -o "$out/$(basename "$f").o"
+  done
+  for f in "$root"/src/*.c; do
+    gcc -Os -fstack-usage -I"$root/src" -w $CFLAGS -c "$f" -o "$out/$(basename "$f").o"
+  done
+else
+  arduino-cli compile --fqbn "$target" --library "$root" --build-path "$out" \
+    --build-property "compiler.cpp.extra_flags=-fstack-usage $CXXFLAGS" \
+    --build-property "compiler.c.extra_flags=-fstack-usage $CFLAGS" "$sketch" >/dev/null
+fi
+
+# Only the library's own sources: mt_*.cpp and nanopb's pb_*.c
+find "$out" -name 'mt_*.su' -o -name 'pb_*.su' | xargs cat \
+  | awk -F '\t' '{
+      match($1, /^[^:]*:[0-9]+:[0-9]+:/)
+      at = substr($1, 1, RLENGTH - 1); sub(/.*\//, "", at); sub(/:[0-9]+$/, "", at)
+      printf "%6d  %-16s %-20s %s\n", $2, $3, at, substr($1, RLENGTH + 1)
+    }' \
+  | sort -rn > "$out/report"
+echo "Stack per function on $target, in bytes, largest first"
+echo
+cat "$out/report"
@@ -11,6 +11,11 @@
     your SSID and wifi password in arduino_secrets.h and run this code with the
     serial monitor open.
 
+    The library only keeps a node table if it's built with MT_NODEDB_SIZE set
+    to how many nodes to keep, e.g. with arduino-cli:
+
+      arduino-cli compile --build-property "compiler.cpp.extra_flags=-DMT_NODEDB_SIZE=32" ...
+
     Created March 2022
     By Mike Schiraldi
 
@@ -36,16 +41,21 @@
 // A different baud rate to communicate with the Meshtastic device can be specified here
 #define BAUD_RATE 9600
 
-// Request a node report every this many msec
-#define NODE_REPORT_PERIOD (30 * 1000)
+// Until the radio's node report arrives, ask for it again every this many msec
+#define NODE_REPORT_RETRY (30 * 1000)
+
+// Print the node database every this many msec. There's no need to ask for another node report:
+// the library keeps it up to date from what the nodes broadcast.
+#define PRINT_PERIOD (30 * 1000)
 
-// Storage for node reports when they come in, such that they can be worked with afterwards.
-mt_node_t node_infos[100];
-uint8_t node_infos_count = 0;
+bool have_node_report = false;
 
 // When millis() is >= this, it's time to request a node report.
 uint32_t next_node_report_time = 0;
 
+// When millis() is >= this, it's time to print the node database.
+uint32_t next_print_time = 0;
+
 void setup() {
   // Try for up to five seconds to find a serial port; if not, the show must go on
   Serial.begin(9600);
@@ -73,13 +83,16 @@ void setup() {
   randomSeed(micros());
 }
 
+// The library keeps every node it hears about in its own table, so there's no need to store
+// them here. To look up a single node, use mt_nodedb_find().
 void print_node_infos() {
   Serial.print("There are "); 
-  Serial.print(node_infos_count);
+  Serial.print(mt_nodedb_count());
   Serial.println(" nodes in the database.");
 
-  for (uint8_t i = 0; i < node_infos_count; i++) {
-    mt_node_t* nodeinfo = &node_infos[i];
+  mt_node_t node;
+  for (uint16_t i = 0; mt_nodedb_at(i, &node); i++) {
+    mt_node_t* nodeinfo = &node;
     Serial.print("The node with number ");
     Serial.print(nodeinfo->node_num);
     Serial.print(" (");
@@ -90,6 +103,11 @@ void print_node_infos() {
     }
     Serial.print(", last reached at time=");
     Serial.print(nodeinfo->last_heard_from);
+    if (!isnan(nodeinfo->snr)) {
+      Serial.print(" with SNR ");
+      Serial.print(nodeinfo->snr);
+      Serial.print(" dB");
+    }
 
     if (nodeinfo->has_user) {
       Serial.print(", belongs to '");
@@ -146,20 +164,18 @@ void print_node_infos() {
 // turned out to have been a reply to someone else's request).
 //
 // Everything passed to this callback could be destroyed immediately
-// after it returns, so it should save it somewhere else if it needs it.
+// after it returns, but the library has already saved it in its node
+// table.
 void node_report_callback(mt_node_t * nodeinfo, mt_nr_progress_t progress) {
   if (progress == MT_NR_IN_PROGRESS) {
-    // We're still in the middle of the report, so save this node info
-    // for later
-    node_infos[node_infos_count++] = *nodeinfo;
+    // We're still in the middle of the report
     return;
   } else if (progress == MT_NR_INVALID) {
-    Serial.println("Oops, ignore all that. It was a reply to someone else's query.");
+    Serial.println("Oops, that was a reply to someone else's query, but the nodes in it are still good.");
     return;
   } else if (progress == MT_NR_DONE) {
-    // At the end of the reports, we print the info we've collected
-    print_node_infos();
-    node_infos_count = 0;
+    // At the end of the report, loop() starts printing the info we've collected
+    have_node_report = true;
     return;
   }
 }
@@ -171,10 +187,15 @@ void loop() {
   // Run the Meshtastic loop, and see if it's able to send requests to the device yet
   bool can_send = mt_loop(now);
 
-  // If we can send requests, and it's time to do so, make a request and schedule
-  // the next one.
-  if (can_send && now >= next_node_report_time) {
+  // If we can send requests, and we don't have a node report yet, make a request
+  // and schedule another in case this one doesn't get through.
+  if (can_send && !have_node_report && now >= next_node_report_time) {
     mt_request_node_report(node_report_callback);
-    next_node_report_time = now + NODE_REPORT_PERIOD;
+    next_node_report_time = now + NODE_REPORT_RETRY;
+  }
+
+  if (have_node_report && now >= next_print_time) {
+    print_node_infos();
+    next_print_time = now + PRINT_PERIOD;
   }
 }
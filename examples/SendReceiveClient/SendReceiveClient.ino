@@ -139,8 +139,9 @@ void setup() {
 
   randomSeed(micros());
 
-  // Initial connection to the Meshtastic device
-  mt_request_node_report(connected_callback);
+  // Initial connection to the Meshtastic device. We only need its own node number
+  // and channels, not every node in the mesh, so skip those: it's much quicker.
+  mt_request_sync(MT_SYNC_CONFIG, connected_callback);
 
   // Register a callback function to be called whenever a text message is received
   set_text_message_callback(text_message_callback);
@@ -155,8 +156,10 @@ void loop() {
   // Run the Meshtastic loop, and see if it's able to send requests to the device yet
   bool can_send = mt_loop(now);
 
-  // If we can send, and it's time to do so, send a text message and schedule the next one.
-  if (can_send && now >= next_send_time) {
+  // If we can send, and know enough about the radio to do so, and it's time to do so,
+  // send a text message and schedule the next one.
+  bool ready = (mt_sync_state() & MT_HAVE_MINIMAL) == MT_HAVE_MINIMAL;
+  if (can_send && ready && now >= next_send_time) {
     
     // Change this to a specific node number if you want to send to just one node
     uint32_t dest = BROADCAST_ADDR; 
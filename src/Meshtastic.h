@@ -36,6 +36,7 @@ typedef struct {
   float voltage;
   float channel_utilization;
   float air_util_tx;
+  float snr;  // Of the last packet we got from it, in dB
 } mt_node_t;
 
 // Initialize, using wifi to connect to the MT radio
@@ -45,8 +46,45 @@ void mt_wifi_init(int8_t cs_pin, int8_t irq_pin, int8_t reset_pin,
 // Initialize, using serial pins and baud rate to connect to the MT radio
 void mt_serial_init(int8_t rx_pin, int8_t tx_pin, uint32_t baud = BAUD_DEFAULT);
 
+// Where received frames are decoded to. Pick one at build time by defining MT_DECODE_TARGET:
+//   MT_DECODE_STATIC   A single static FromRadio inside the library (the default)
+//   MT_DECODE_ARENA    A buffer of at least MT_DECODE_ARENA_SIZE bytes that you supply with
+//                      mt_set_decode_arena(); frames wait in the receive buffer until you do
+//   MT_DECODE_VARIANT  Only the payload variants the library acts on are decoded, into static
+//                      storage the size of the largest of them
+#define MT_DECODE_STATIC 0
+#define MT_DECODE_ARENA 1
+#define MT_DECODE_VARIANT 2
+#ifndef MT_DECODE_TARGET
+#define MT_DECODE_TARGET MT_DECODE_STATIC
+#endif
+
+#if MT_DECODE_TARGET == MT_DECODE_ARENA
+#define MT_DECODE_ARENA_SIZE sizeof(meshtastic_FromRadio)
+
+// Decode received frames into arena, which must be suitably aligned for any struct and stay valid
+// until replaced. It's only written to from inside mt_loop() and mt_poll(), so it can be used for
+// something else in between, unless a frame has been retained with mt_retain_frame().
+// Returns false if len is too small.
+bool mt_set_decode_arena(void * arena, size_t len);
+#endif
+
 // Call this once per loop() and pass the current millis(). Returns bool indicating whether the connection is ready.
-bool mt_loop(uint32_t now);
+// Every complete frame already received is handled in one call, up to the drain budget below. If
+// frames_handled is given, it's set to the number of frames handled during this call.
+bool mt_loop(uint32_t now, uint16_t * frames_handled = NULL);
+
+// A non-blocking alternative to mt_loop(): it never sleeps inside the library. Sets *next_due (if
+// not NULL) to the millis() value at which timed work (a heartbeat, a reconnect attempt, an idle
+// timeout, or frames left over from an exhausted drain budget) is next due, so the caller can
+// sleep or service other I/O until then. Bytes arriving from the radio may need handling sooner,
+// so call it again when there's input too. Returns the same as mt_loop().
+bool mt_poll(uint32_t now, uint32_t * next_due, uint16_t * frames_handled = NULL);
+
+// Limit how many frames, and how many msec, a single mt_loop() call may spend handling frames
+// that have already arrived. A max_ms of 0 means no time limit. The defaults are 32 frames and 50 msec;
+// use a frame budget of 1 to handle a single frame per call as older versions did.
+void mt_set_drain_budget(uint16_t max_frames, uint32_t max_ms);
 
 // Will print lots of (semi)useful information to the main Serial output
 void mt_set_debug(bool on);
@@ -72,16 +110,318 @@ typedef enum {
 // even do that.
 bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t));
 
+// What to ask the radio for. A full node report sends everything the radio knows, which on a big
+// mesh at 9600 baud takes many seconds; the radio can also send just its config, or just the nodes.
+typedef enum {
+  MT_SYNC_FULL,    // Our node's info, its channels and config, and every node (a node report)
+  MT_SYNC_CONFIG,  // Our node's info, its channels and config, but no other nodes
+  MT_SYNC_NODES,   // Node info only
+  MT_SYNC_STAGED   // MT_SYNC_CONFIG, then MT_SYNC_NODES as soon as that's done
+} mt_sync_mode_t;
+
+// Like mt_request_node_report(), but for just part of what the radio knows. The callback (which
+// may be NULL) hears about every node that arrives, and gets MT_NR_DONE at the very end.
+bool mt_request_sync(mt_sync_mode_t mode, void (*callback)(mt_node_t *, mt_nr_progress_t) = NULL);
+
+// What we've heard from the radio so far, as a mask of these. The radio sends its own info first
+// and its channels soon after, so MT_HAVE_MINIMAL comes early in MT_SYNC_FULL, MT_SYNC_CONFIG or
+// MT_SYNC_STAGED; from then on it's safe to send, while the rest is still streaming in.
+#define MT_HAVE_MY_INFO 0x01   // Our node number
+#define MT_HAVE_CHANNELS 0x02
+#define MT_HAVE_CONFIG 0x04
+#define MT_HAVE_NODES 0x08
+#define MT_HAVE_MINIMAL (MT_HAVE_MY_INFO | MT_HAVE_CHANNELS)
+
+uint8_t mt_sync_state();
+
+// The radio has this many channel slots, some perhaps disabled
+#define MT_MAX_CHANNELS 8
+
+// Copy out a channel the radio told us about. Returns false if it hasn't (yet).
+bool mt_get_channel(uint8_t index, meshtastic_Channel * channel);
+
+// Every node report can also be kept in the library's node table, whether or not a callback was
+// given. It holds up to MT_NODEDB_SIZE nodes, which is 0 (no table at all) unless you define it at
+// build time, e.g. with arduino-cli's
+//
+//   --build-property "compiler.cpp.extra_flags=-DMT_NODEDB_SIZE=32"
+//
+// since it has to reach the library's own sources. Once it's full, the node heard from least
+// recently makes way for a new one.
+//
+// After that, the table keeps itself up to date from the names, positions and device metrics nodes
+// broadcast, and the time and SNR of every packet, so one report after connecting is enough.
+//
+// To save memory, the table keeps voltages to the nearest mV, utilizations to the nearest 0.01%
+// and SNRs to the nearest 0.25 dB, so that's what you get back. Names share a pool of
+// MT_NODEDB_NAMES_SIZE bytes (24 per node unless you define it otherwise).
+
+// Copy out what we know about a node. Returns false if we don't know it.
+bool mt_nodedb_find(uint32_t node_num, mt_node_t * node);
+
+// Walk the table: copy out the i'th node, for i from 0 to mt_nodedb_count() - 1, in no
+// particular order. Returns false if there's no such node.
+uint16_t mt_nodedb_count();
+bool mt_nodedb_at(uint16_t i, mt_node_t * node);
+
+void mt_nodedb_clear();
+
+// How many names have been left empty because the pool of MT_NODEDB_NAMES_SIZE bytes was full. If
+// this goes up, define it bigger.
+uint32_t mt_nodedb_names_lost();
+
+// Snapshots of the node table and what the radio told us about itself (our node number, channels
+// and LoRa config), so that after a restart the app needn't wait for a sync before it can send or
+// look up nodes. Load the last snapshot before connecting, then call mt_request_sync() to catch up
+// with anything that changed in the meantime. A snapshot gives MT_HAVE_MY_INFO and MT_HAVE_CHANNELS
+// but never MT_HAVE_CONFIG or MT_HAVE_NODES, which only the radio can vouch for.
+//
+// All return false if the snapshot couldn't be written or read in full. A snapshot that fails to
+// load may have been partly applied; mt_nodedb_clear() if that matters.
+//
+// A snapshot holds the channels as the radio sent them, PSKs included, in plaintext. Anyone who can
+// read where it's stored can read the channels' traffic, so keep it somewhere they can't.
+
+// Write to or read from any nanopb stream, for storage of your own
+bool mt_snapshot_save(pb_ostream_t * stream);
+bool mt_snapshot_load(pb_istream_t * stream);
+
+// Write to or read from an Arduino stream, such as a File on LittleFS, SPIFFS or an SD card
+bool mt_snapshot_save_stream(Print & out);
+bool mt_snapshot_load_stream(Stream & in);
+
+// Files through stdio, on hosts that have them
+#if !defined(MT_SNAPSHOT_FILES) && defined(__linux__)
+#define MT_SNAPSHOT_FILES
+#endif
+#ifdef MT_SNAPSHOT_FILES
+bool mt_snapshot_save_file(const char * path);
+bool mt_snapshot_load_file(const char * path);
+#endif
+
+// EEPROM, if the library is built with MT_SNAPSHOT_EEPROM defined (as a build flag, since it has to
+// reach the library's own sources too). A snapshot takes about 100 bytes plus 80 or so per node, so
+// it won't fit on small AVRs with more than a handful of nodes; max_len caps what's written.
+#ifdef MT_SNAPSHOT_EEPROM
+bool mt_snapshot_save_eeprom(int address, size_t max_len);
+bool mt_snapshot_load_eeprom(int address, size_t max_len);
+#endif
+
 // Set the callback function that gets called when the node receives a text message.
 void set_text_message_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, const char * text));
 
 // Set the callback function that gets called when the node receives any other portNum
 void set_portnum_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload));
 
+// A view of bytes owned by the library. It has an explicit length and is not NUL-terminated.
+typedef struct {
+  const uint8_t * data;
+  size_t len;
+} mt_bytes_t;
+
+// Everything about a received packet other than its payload
+typedef struct {
+  uint32_t id;
+  uint32_t from;
+  uint32_t to;
+  uint8_t channel;
+  meshtastic_PortNum portnum;  // UNKNOWN_APP if the packet is encrypted
+  bool encrypted;              // If true, the payload is the still-encrypted packet
+  uint32_t request_id;         // For replies, the ID of the packet being replied to
+  uint32_t rx_time;            // Seconds since 1970, as stamped by the radio
+  float rx_snr;
+  int32_t rx_rssi;
+  uint8_t hop_limit;
+  uint8_t hop_start;           // hop_start - hop_limit is the number of hops the packet took
+  bool want_ack;
+  bool via_mqtt;
+} mt_packet_meta_t;
+
+// Set the callback function that gets called for every packet the node receives, decoded or
+// encrypted, with its metadata and a view of its payload. Neither is copied: they point into
+// the library's buffer for the frame being handled, and are only valid until the callback
+// returns, unless the callback calls mt_retain_frame().
+void set_packet_callback(void (*callback)(const mt_packet_meta_t * meta, mt_bytes_t payload));
+
+// Call from within a receive callback to keep the current frame (and so every pointer the
+// callbacks were given for it) valid after the callback returns, until mt_release_frame() is
+// called. No further frames are handled in the meantime; they wait in the receive buffer, so
+// release it soon. Returns false, doing nothing, if called outside a callback.
+bool mt_retain_frame();
+void mt_release_frame();
+
+// Only deliver packets on the given ports. Until this is first called, packets on every port are
+// delivered; afterwards, only those on subscribed ports are.
+//
+// If MT_PEEK_FILTER is defined at build time, frames nobody would act on (unsubscribed ports, or
+// variants with no callback set) are also skipped without being decoded. Finding that out means
+// walking each frame's tags first, so the frames that are wanted cost a second pass. It's only
+// worth it when most aren't: for an app that wants a port or two, without the node table, which
+// needs every position, telemetry and node info packet decoded.
+void mt_subscribe_portnum(meshtastic_PortNum port, bool subscribe = true);
+
 // Set the callback function that gets called when the node receives an encrypted payload
 void set_encrypted_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload));
 
+// Set the callback function that gets called with any plain text (usually the radio's debug console)
+// found on the connection between frames. The text isn't NUL-terminated, lines may be split across
+// calls, and it's only valid until the callback returns.
+void set_console_log_callback(void (*callback)(const char * text, size_t len));
+
+// Counters describing the health of the incoming byte stream
+typedef struct {
+  uint32_t bytes_discarded;  // Bytes dropped while looking for the start of the next frame, including console text
+  uint32_t console_bytes;    // The part of bytes_discarded that was passed to the console log callback
+  uint32_t frames_oversized; // Frames skipped because they wouldn't fit in the receive buffer
+  uint32_t decode_errors;    // Complete frames whose protobuf couldn't be decoded
+  uint32_t frames_filtered;  // Frames skipped without decoding because nothing was interested in them (see MT_PEEK_FILTER)
+} mt_rx_stats_t;
+
+void mt_get_rx_stats(mt_rx_stats_t * stats);
+
 // Send a text message with *text* as payload, to a destination node (optional), on a certain channel (optional).
+// The message goes on the TX queue and is written to the radio once it reports room for it. Returns
+// false if it couldn't be queued.
 bool mt_send_text(const char * text, uint32_t dest = BROADCAST_ADDR, uint8_t channel_index = 0);
 
+// Set a codec for the compressed text port. The firmware and other clients use unishox2 there, and
+// it's the default when unishox2.c and unishox2.h are in src/, as bin/fetch-unishox2.sh puts them.
+// Another codec can be set instead, or none (NULL for both).
+//
+// Each returns how many bytes it wrote to out, or 0 if it couldn't (the output wouldn't fit, say).
+// With a codec set, mt_send_text() sends compressed text whenever that's shorter, and compressed
+// text that arrives is decompressed and handed to the text message callback. Without one, it goes
+// to the portnum callback as is. Either way, text is limited to what fits in a packet uncompressed,
+// since that's as much as is decompressed on receipt.
+void mt_set_text_codec(size_t (*compress)(const char * text, size_t len, uint8_t * out, size_t out_size),
+                       size_t (*decompress)(const uint8_t * data, size_t len, char * out, size_t out_size));
+
+// Send a packet carrying *payload* on a certain port. The payload is encoded straight from the
+// caller's buffer into the TX queue, so it needn't outlive the call. Returns false if it's too big
+// for a packet or couldn't be queued. If packet_id isn't NULL, it's set to the packet's ID, which
+// the delivery callback reports it by.
+bool mt_send_data(meshtastic_PortNum port, mt_bytes_t payload, uint32_t dest = BROADCAST_ADDR,
+                  uint8_t channel_index = 0, bool want_ack = false, uint32_t * packet_id = NULL);
+
+// Messages too big for one packet can be sent in chunks of 225 bytes, up to MT_CHUNK_MAX_COUNT of
+// them, which the receiving end (also running this library) puts back together. Chunks are sent on
+// MT_CHUNK_PORT, and the receiver asks for any that go missing on MT_CHUNK_RESPONSE_PORT. Each
+// message being reassembled takes MT_CHUNK_MAX_COUNT * 225 bytes of RAM, so it's 0 (large messages
+// left out, and mt_send_large() always false) unless defined at build time, like MT_NODEDB_SIZE.
+#ifndef MT_CHUNK_MAX_COUNT
+#define MT_CHUNK_MAX_COUNT 0
+#endif
+#ifndef MT_CHUNK_PORT
+#define MT_CHUNK_PORT ((meshtastic_PortNum)300)
+#endif
+#ifndef MT_CHUNK_RESPONSE_PORT
+#define MT_CHUNK_RESPONSE_PORT ((meshtastic_PortNum)301)
+#endif
+
+typedef enum {
+  MT_CHUNK_DELIVERED,  // The receiver has every chunk
+  MT_CHUNK_SENT,       // Every chunk of a broadcast was queued; nobody says whether they arrived
+  MT_CHUNK_TIMED_OUT   // The receiver went quiet before it had them all
+} mt_chunk_result_t;
+
+// Send *data* in chunks. The library reads from it as chunks go out, and again if any have to be
+// resent, so it must stay valid until the large send callback reports this payload_id done.
+bool mt_send_large(const uint8_t * data, size_t len, uint32_t dest = BROADCAST_ADDR,
+                   uint8_t channel_index = 0, uint32_t * payload_id = NULL);
+
+void set_large_send_callback(void (*callback)(uint32_t payload_id, mt_chunk_result_t result));
+
+// Set the callback that gets each reassembled message. Until one is set, chunks aren't reassembled,
+// and reach the other receive callbacks like packets on any other port. The data is only valid
+// until the callback returns.
+void set_large_message_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, mt_bytes_t data));
+
+// Send a MeshPacket the caller has built, encoding it in place. Set its id, which is how the radio
+// refers to it in QueueStatus reports.
+bool mt_send_packet(const meshtastic_MeshPacket * packet);
+
+// Send any other kind of ToRadio (such as an MQTT proxy message) straight to the radio, without
+// going through the TX queue. Build with MT_STREAMING_ENCODE to encode it straight onto the
+// connection instead of into a 516-byte buffer first.
+bool mt_send_toRadio(const meshtastic_ToRadio * toRadio);
+
+// Packets are written to the radio highest priority first, with the longer-waiting ones bumped up
+// over time as far as the next level (but never to HIGH, so alerts aren't held up). Unless a
+// packet passed to mt_send_packet() sets its own, it gets the priority set for its port here or,
+// by default, the one the firmware would give it: HIGH for detection sensor alerts, BACKGROUND for
+// position, telemetry and the like, RELIABLE for anything sent with want_ack, and DEFAULT for the
+// rest. A few ports can be set; UNSET puts a port back to its default.
+void mt_set_port_priority(meshtastic_PortNum port, meshtastic_MeshPacket_Priority priority);
+
+// The airtime governor holds back packets below DEFAULT priority while the channel is more than
+// 25% busy, and packets below HIGH priority that would take our own airtime over the region's duty
+// cycle limit, for up to a minute. It goes by what our radio last reported, plus its own estimate
+// of the airtime of everything sent since.
+typedef struct {
+  float channel_utilization;  // Percent, as last reported by the radio (NAN until it has been)
+  float air_util_tx;          // Percent of the last hour we spent transmitting, as last reported
+  float est_air_util_tx;      // That plus our estimate for what we've sent since
+  uint32_t held;              // Packets the governor has held back
+} mt_airtime_t;
+
+void mt_get_airtime(mt_airtime_t * stats);
+
+// Estimated time on air, in msec, of a packet with this much payload, with the radio's LoRa settings
+uint32_t mt_airtime_ms(size_t payload_len);
+
+// Counters for the TX queue, which paces outgoing packets against the free slots the radio reports
+// in its own TX queue, so that bursts aren't silently dropped by the firmware.
+typedef struct {
+  uint8_t depth;        // Packets waiting to be written, or written but not yet accepted by the radio
+  uint8_t awaiting_ack; // Packets sent with want_ack that the mesh hasn't answered yet
+  uint16_t radio_free;  // Free slots in the radio's TX queue, as of its last report
+  uint32_t queued;      // Packets put on the queue
+  uint32_t written;     // Writes to the radio, including rewrites of requeued packets
+  uint32_t accepted;    // Packets the radio confirmed it took
+  uint32_t requeued;    // Times the radio turned a packet away and we put it back on the queue
+  uint32_t dropped;     // Packets we couldn't queue because the queue was full
+  uint32_t rejected;    // Packets given up on after the radio turned them away too many times
+  uint32_t resent;      // Packets sent again because the mesh didn't ACK them
+} mt_tx_stats_t;
+
+void mt_get_tx_stats(mt_tx_stats_t * stats);
+
+// Log lines (with MT_DEBUGGING, and a few status messages) are queued and written to Serial from
+// mt_poll(), only as fast as Serial can take them. This counts the lines dropped because the queue
+// was full.
+uint32_t mt_log_dropped_lines();
+
+// What became of a packet sent with want_ack
+typedef enum {
+  MT_DELIVERY_ACKED,     // The destination ACKed it (or, for a broadcast, a neighbour passed it on)
+  MT_DELIVERY_RELAYED,   // A neighbour passed it on, but the destination itself never ACKed it
+  MT_DELIVERY_FAILED,    // The mesh NAKed it; error says why
+  MT_DELIVERY_TIMED_OUT, // No ACK or NAK came back in time
+  MT_DELIVERY_REJECTED   // The radio wouldn't take it
+} mt_delivery_t;
+
+// Set a callback to hear what became of every packet sent with want_ack, with the round trip time
+// from when it was last written to the radio. Until one is set, such packets aren't tracked at all.
+// Up to MT_ACK_WAIT_LEN (4) can be waiting at once; more are refused until some are answered.
+void set_delivery_callback(void (*callback)(uint32_t packet_id, uint32_t dest, mt_delivery_t result,
+                                            meshtastic_Routing_Error error, uint32_t rtt_ms));
+
+// How long to wait for an ACK (60 s by default; the radio retries on its own for some of that) and
+// how many times to send a packet again when it times out or the radio gives up on it (0 by default).
+// With resends, each tracked packet's frame stays on the TX queue until it's answered.
+void mt_set_delivery_policy(uint32_t timeout_ms, uint8_t resends);
+
+// Delivery stats kept for the last few destinations sent to with want_ack
+#define MT_RTT_BUCKETS 12
+typedef struct {
+  uint32_t node;
+  uint32_t sent;
+  uint32_t acked;   // Including MT_DELIVERY_RELAYED
+  uint32_t failed;  // Failed, timed out or rejected
+  uint16_t rtt_hist[MT_RTT_BUCKETS]; // Bucket i counts round trips under 128 << i ms; the last, the rest
+} mt_link_stats_t;
+
+// Returns false if we have no stats for that node
+bool mt_get_link_stats(uint32_t node, mt_link_stats_t * stats);
+
 #endif
@@ -0,0 +1,174 @@
+#include "mt_internals.h"
+
+// Keeps the TX queue from sending low-priority packets the firmware would only drop, or that
+// would crowd out more important ones, when the channel is busy or we've used up our duty cycle.
+//
+// The radio reports how busy the channel is (channel_utilization, percent over the last minute) and
+// how much of the last hour we've spent transmitting (air_util_tx, percent) in the DeviceMetrics of
+// our own NodeInfo and telemetry. Between reports we add on our own estimate of the airtime of
+// every packet we've written since, worked out from the LoRa settings in its Config.
+
+// Below DEFAULT priority, hold packets while the channel is busier than this. It's the threshold
+// the firmware itself uses to skip its own periodic broadcasts.
+#define POLITE_CHANNEL_UTIL 25.0f
+
+// Below HIGH priority, hold packets that would take our airtime past the region's duty cycle
+// limit, less this much headroom, since the firmware refuses to send past the limit itself
+#define DUTY_CYCLE_HEADROOM 1.0f
+
+// Never hold a packet longer than this. By then the app would rather it went late than not at all,
+// and it's been hogging a queue slot.
+#define MAX_HOLD_MS 60000UL
+
+// air_util_tx covers the last hour
+#define AIR_UTIL_WINDOW_MS 3600000UL
+
+// Meshtastic sends a 16-symbol preamble and a 16-byte header in front of every packet
+#define LORA_PREAMBLE 16
+#define MESH_HEADER_SIZE 16
+
+// The LoRa settings from the radio's config, as bandwidth in Hz, spreading factor and coding rate
+// denominator. Until its config arrives, assume LONG_FAST, the default.
+uint32_t lora_bw = 250000;
+uint8_t lora_sf = 11;
+uint8_t lora_cr = 5;
+float duty_cycle_limit = 100;
+
+mt_airtime_t airtime = {NAN, NAN, 0, 0};
+uint32_t airtime_since_report_ms = 0;
+
+void mt_airtime_set_lora(const meshtastic_Config_LoRaConfig * lora) {
+  if (lora->use_preset) {
+    switch (lora->modem_preset) {
+      case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_TURBO: lora_bw = 500000; lora_sf = 7; lora_cr = 5; break;
+      case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_FAST: lora_bw = 250000; lora_sf = 7; lora_cr = 5; break;
+      case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_SLOW: lora_bw = 250000; lora_sf = 8; lora_cr = 5; break;
+      case meshtastic_Config_LoRaConfig_ModemPreset_MEDIUM_FAST: lora_bw = 250000; lora_sf = 9; lora_cr = 5; break;
+      case meshtastic_Config_LoRaConfig_ModemPreset_MEDIUM_SLOW: lora_bw = 250000; lora_sf = 10; lora_cr = 5; break;
+      case meshtastic_Config_LoRaConfig_ModemPreset_LONG_MODERATE: lora_bw = 125000; lora_sf = 11; lora_cr = 8; break;
+      case meshtastic_Config_LoRaConfig_ModemPreset_LONG_SLOW: lora_bw = 125000; lora_sf = 12; lora_cr = 8; break;
+      case meshtastic_Config_LoRaConfig_ModemPreset_VERY_LONG_SLOW: lora_bw = 62500; lora_sf = 12; lora_cr = 8; break;
+      default: lora_bw = 250000; lora_sf = 11; lora_cr = 5; break;  // LONG_FAST
+    }
+  } else {
+    // A few bandwidths are given in whole kHz but really have a fraction
+    switch (lora->bandwidth) {
+      case 31: lora_bw = 31250; break;
+      case 62: lora_bw = 62500; break;
+      case 200: lora_bw = 203125; break;
+      case 400: lora_bw = 406250; break;
+      case 800: lora_bw = 812500; break;
+      case 1600: lora_bw = 1625000; break;
+      default: lora_bw = lora->bandwidth * 1000UL; break;
+    }
+    if (lora_bw == 0) lora_bw = 250000;
+    lora_sf = lora->spread_factor >= 5 && lora->spread_factor <= 12 ? lora->spread_factor : 11;
+    lora_cr = lora->coding_rate >= 5 && lora->coding_rate <= 8 ? lora->coding_rate : 5;
+  }
+
+  bool eu = lora->region == meshtastic_Config_LoRaConfig_RegionCode_EU_433
+    || lora->region == meshtastic_Config_LoRaConfig_RegionCode_EU_868;
+  duty_cycle_limit = eu && !lora->override_duty_cycle ? 10 : 100;
+}
+
+// The standard LoRa time-on-air formula (Semtech AN1200.13), with an explicit header and a CRC
+uint32_t mt_airtime_ms(size_t payload_len) {
+  float symbol_ms = (float)(1UL << lora_sf) * 1000 / lora_bw;
+  int de = symbol_ms > 16 ? 1 : 0;  // Low data rate optimisation
+  int bits = 8 * (int)(payload_len + MESH_HEADER_SIZE) - 4 * lora_sf + 28 + 16;
+  int per_block = 4 * (lora_sf - 2 * de);
+  int blocks = bits > 0 ? (bits + per_block - 1) / per_block : 0;
+  float symbols = LORA_PREAMBLE + 4.25f + 8 + blocks * lora_cr;
+  return (uint32_t)(symbols * symbol_ms + 0.5f);
+}
+
+static void set_util(float channel_utilization, float air_util_tx) {
+  airtime.channel_utilization = channel_utilization;
+  airtime.air_util_tx = air_util_tx;
+  airtime_since_report_ms = 0;
+}
+
+void mt_airtime_handle_node_info(const meshtastic_NodeInfo * nodeInfo) {
+  if (nodeInfo->num != my_node_num || !nodeInfo->has_device_metrics) return;
+  const meshtastic_DeviceMetrics *m = &nodeInfo->device_metrics;
+  if (m->has_channel_utilization && m->has_air_util_tx) set_util(m->channel_utilization, m->air_util_tx);
+}
+
+// Pick channel_utilization and air_util_tx out of DeviceMetrics or LocalStats, whose tags for them
+// are given
+static bool read_util(pb_istream_t * stream, uint32_t chutil_tag, uint32_t airutil_tag) {
+  float chutil = NAN, airutil = NAN;
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    if ((tag == chutil_tag || tag == airutil_tag) && wire_type == PB_WT_32BIT) {
+      if (!pb_decode_fixed32(stream, tag == chutil_tag ? &chutil : &airutil)) return false;
+    } else if (!pb_skip_field(stream, wire_type)) {
+      return false;
+    }
+  }
+  if (!eof || isnan(chutil) || isnan(airutil)) return false;
+  set_util(chutil, airutil);
+  return true;
+}
+
+// Our own node's telemetry says how busy the channel is
+void mt_airtime_handle_packet(const meshtastic_MeshPacket * packet) {
+  if (packet->from != my_node_num || my_node_num == 0) return;
+  if (packet->which_payload_variant != meshtastic_MeshPacket_decoded_tag) return;
+  if (packet->decoded.portnum != meshtastic_PortNum_TELEMETRY_APP) return;
+
+  const meshtastic_Data_payload_t *payload = &packet->decoded.payload;
+  pb_istream_t stream = pb_istream_from_buffer(payload->bytes, payload->size);
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    bool device = tag == meshtastic_Telemetry_device_metrics_tag;
+    if ((device || tag == meshtastic_Telemetry_local_stats_tag) && wire_type == PB_WT_STRING) {
+      pb_istream_t sub;
+      if (!pb_make_string_substream(&stream, &sub)) return;
+      if (device) {
+        read_util(&sub, meshtastic_DeviceMetrics_channel_utilization_tag, meshtastic_DeviceMetrics_air_util_tx_tag);
+      } else {
+        read_util(&sub, meshtastic_LocalStats_channel_utilization_tag, meshtastic_LocalStats_air_util_tx_tag);
+      }
+      return;
+    }
+    if (!pb_skip_field(&stream, wire_type)) return;
+  }
+}
+
+// Our share of the last hour's airtime, including what we've sent since the radio last said
+static float air_util_tx(uint32_t extra_ms) {
+  float reported = isnan(airtime.air_util_tx) ? 0 : airtime.air_util_tx;
+  return reported + (airtime_since_report_ms + extra_ms) * 100.0f / AIR_UTIL_WINDOW_MS;
+}
+
+// Whether a packet of this priority and frame length may be written now
+bool mt_airtime_clear(uint8_t priority, size_t len, uint32_t queued_at, uint32_t now) {
+  if (priority >= meshtastic_MeshPacket_Priority_HIGH) return true;
+  if (now - queued_at >= MAX_HOLD_MS) return true;
+
+  if (air_util_tx(mt_airtime_ms(len)) > duty_cycle_limit - DUTY_CYCLE_HEADROOM) return false;
+  if (priority < meshtastic_MeshPacket_Priority_DEFAULT && airtime.channel_utilization > POLITE_CHANNEL_UTIL) {
+    return false;
+  }
+  return true;
+}
+
+void mt_airtime_count_held() {
+  airtime.held++;
+}
+
+// The frame's MeshPacket is a little bigger than the Data that goes on air, so our estimate errs
+// on the long side
+void mt_airtime_sent(size_t len) {
+  airtime_since_report_ms += mt_airtime_ms(len);
+}
+
+void mt_get_airtime(mt_airtime_t * stats) {
+  *stats = airtime;
+  stats->est_air_util_tx = air_util_tx(0);
+}
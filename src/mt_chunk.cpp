@@ -0,0 +1,412 @@
+#include "mt_internals.h"
+
+// Messages too big for one packet are split into ChunkedPayload messages, sent on MT_CHUNK_PORT,
+// and put back together on the other end. The receiver answers on MT_CHUNK_RESPONSE_PORT with a
+// ChunkedPayloadResponse: resend_chunks listing any chunks that didn't arrive, or accept_transfer
+// once it has them all. Broadcasts get no answers, so they're sent once and hoped for the best.
+
+#if MT_CHUNK_MAX_COUNT > 0
+// How many large messages can be on their way out, and coming in, at once
+#ifndef MT_CHUNK_TX_SLOTS
+#define MT_CHUNK_TX_SLOTS 2
+#endif
+#ifndef MT_CHUNK_RX_SLOTS
+#define MT_CHUNK_RX_SLOTS 1
+#endif
+
+// Each reassembly slot holds a whole message, so this sets how much RAM they take
+#if MT_CHUNK_MAX_COUNT > 32
+#error "MT_CHUNK_MAX_COUNT can be at most 32"
+#endif
+
+// The most data a chunk can carry and still fit in a packet, once the ChunkedPayload's other
+// fields and the chunk's own tag and length are added (12 bytes at most)
+#define CHUNK_DATA_SIZE (meshtastic_Constants_DATA_PAYLOAD_LEN - 12)
+
+// A chunk's frame on the TX queue is never bigger than this: a full Data payload, plus the frame
+// header and the ToRadio, MeshPacket and Data fields around it (32 bytes at most)
+#define CHUNK_FRAME_SIZE (MT_HEADER_SIZE + 32 + meshtastic_Constants_DATA_PAYLOAD_LEN)
+
+// The receiver waits this long after the last chunk arrived before asking for any it's missing...
+#define CHUNK_GAP_MS 5000
+// ...asks this many times, and then gives up
+#define CHUNK_MAX_REQUESTS 3
+
+// The sender gives up if it hasn't heard anything this long after sending its last chunk
+#define CHUNK_ACK_TIMEOUT_MS 30000
+
+// How many of the messages last put back together are remembered, so that chunks of theirs that
+// turn up late are dropped, rather than starting the message over and asking for the rest of it
+#define CHUNK_DONE_LEN 4
+
+typedef struct {
+  const uint8_t *data;  // The caller's, who keeps it valid until the send callback says we're done
+  size_t len;
+  uint32_t payload_id;  // 0 if the slot is free
+  uint32_t dest;
+  uint8_t channel;
+  uint8_t chunk_count;
+  uint32_t to_send;     // Chunks still to be sent, one bit each
+  uint32_t last_at;
+} mt_chunk_tx_t;
+
+typedef struct {
+  uint32_t payload_id;  // 0 if the slot is free
+  uint32_t from;
+  uint32_t to;
+  uint8_t channel;
+  uint8_t chunk_count;
+  uint8_t requests_left;
+  uint32_t received;    // Chunks that have arrived, one bit each
+  size_t len;
+  uint32_t last_at;
+  uint8_t data[MT_CHUNK_MAX_COUNT * CHUNK_DATA_SIZE];
+} mt_chunk_rx_t;
+
+mt_chunk_tx_t chunk_tx[MT_CHUNK_TX_SLOTS];
+mt_chunk_rx_t chunk_rx[MT_CHUNK_RX_SLOTS];
+
+struct {
+  uint32_t payload_id;
+  uint32_t from;
+} chunk_done[CHUNK_DONE_LEN];
+uint8_t chunk_done_next = 0;
+
+// ChunkedPayload messages are encoded here, then copied into the TX queue
+pb_byte_t chunk_buf[meshtastic_Constants_DATA_PAYLOAD_LEN];
+
+void (*large_message_callback)(uint32_t from, uint32_t to, uint8_t channel, mt_bytes_t data) = NULL;
+void (*large_send_callback)(uint32_t payload_id, mt_chunk_result_t result) = NULL;
+
+void set_large_message_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, mt_bytes_t data)) {
+  large_message_callback = callback;
+}
+
+void set_large_send_callback(void (*callback)(uint32_t payload_id, mt_chunk_result_t result)) {
+  large_send_callback = callback;
+}
+
+static uint32_t all_chunks(uint8_t count) {
+  return count == 32 ? 0xFFFFFFFFUL : (1UL << count) - 1;
+}
+
+bool mt_send_large(const uint8_t * data, size_t len, uint32_t dest, uint8_t channel_index, uint32_t * payload_id) {
+  size_t count = (len + CHUNK_DATA_SIZE - 1) / CHUNK_DATA_SIZE;
+  if (count == 0 || count > MT_CHUNK_MAX_COUNT) {
+    d("Can't send a %u byte message in chunks", (unsigned)len);
+    return false;
+  }
+
+  for (int i = 0; i < MT_CHUNK_TX_SLOTS; i++) {
+    mt_chunk_tx_t *tx = &chunk_tx[i];
+    if (tx->payload_id != 0) continue;
+    tx->data = data;
+    tx->len = len;
+    tx->payload_id = 1 + random(0x0FFFFFFF);  // Small enough to keep its varint to 4 bytes
+    tx->dest = dest;
+    tx->channel = channel_index;
+    tx->chunk_count = count;
+    tx->to_send = all_chunks(count);
+    tx->last_at = millis();
+    if (payload_id != NULL) *payload_id = tx->payload_id;
+    mt_chunk_service(tx->last_at);
+    return true;
+  }
+  d("No free slot to send a large message");
+  return false;
+}
+
+static bool send_chunk(mt_chunk_tx_t * tx, uint8_t index) {
+  size_t offset = index * CHUNK_DATA_SIZE;
+  size_t len = tx->len - offset;
+  if (len > CHUNK_DATA_SIZE) len = CHUNK_DATA_SIZE;
+
+  pb_ostream_t stream = pb_ostream_from_buffer(chunk_buf, sizeof(chunk_buf));
+  bool status = pb_encode_tag(&stream, PB_WT_VARINT, meshtastic_ChunkedPayload_payload_id_tag)
+    && pb_encode_varint(&stream, tx->payload_id)
+    && pb_encode_tag(&stream, PB_WT_VARINT, meshtastic_ChunkedPayload_chunk_count_tag)
+    && pb_encode_varint(&stream, tx->chunk_count)
+    && pb_encode_tag(&stream, PB_WT_VARINT, meshtastic_ChunkedPayload_chunk_index_tag)
+    && pb_encode_varint(&stream, index)
+    && pb_encode_tag(&stream, PB_WT_STRING, meshtastic_ChunkedPayload_payload_chunk_tag)
+    && pb_encode_string(&stream, tx->data + offset, len);
+  if (!status) return false;
+
+  mt_bytes_t payload;
+  payload.data = chunk_buf;
+  payload.len = stream.bytes_written;
+  return mt_send_data(MT_CHUNK_PORT, payload, tx->dest, tx->channel);
+}
+
+static void send_done(mt_chunk_tx_t * tx, mt_chunk_result_t result) {
+  uint32_t id = tx->payload_id;
+  tx->payload_id = 0;
+  if (large_send_callback != NULL) large_send_callback(id, result);
+}
+
+// Send the receiver a ChunkedPayloadResponse: accept_transfer if it has everything, or else
+// resend_chunks with the ones it's missing
+static void send_response(mt_chunk_rx_t * rx) {
+  uint32_t missing = all_chunks(rx->chunk_count) & ~rx->received;
+  pb_ostream_t stream = pb_ostream_from_buffer(chunk_buf, sizeof(chunk_buf));
+  pb_encode_tag(&stream, PB_WT_VARINT, meshtastic_ChunkedPayloadResponse_payload_id_tag);
+  pb_encode_varint(&stream, rx->payload_id);
+  if (missing == 0) {
+    pb_encode_tag(&stream, PB_WT_VARINT, meshtastic_ChunkedPayloadResponse_accept_transfer_tag);
+    pb_encode_varint(&stream, 1);
+  } else {
+    // resend_chunks holds a single packed field of chunk indexes, each of which is one byte long
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < rx->chunk_count; i++) {
+      if (missing & (1UL << i)) n++;
+    }
+    pb_encode_tag(&stream, PB_WT_STRING, meshtastic_ChunkedPayloadResponse_resend_chunks_tag);
+    pb_encode_varint(&stream, 2 + n);
+    pb_encode_tag(&stream, PB_WT_STRING, meshtastic_resend_chunks_chunks_tag);
+    pb_encode_varint(&stream, n);
+    for (uint8_t i = 0; i < rx->chunk_count; i++) {
+      if (missing & (1UL << i)) pb_encode_varint(&stream, i);
+    }
+  }
+
+  mt_bytes_t payload;
+  payload.data = chunk_buf;
+  payload.len = stream.bytes_written;
+  mt_send_data(MT_CHUNK_RESPONSE_PORT, payload, rx->from, rx->channel);
+}
+
+// Feed outgoing chunks to the TX queue as it has room, and deal with anything that's timed out
+void mt_chunk_service(uint32_t now) {
+  for (int i = 0; i < MT_CHUNK_TX_SLOTS; i++) {
+    mt_chunk_tx_t *tx = &chunk_tx[i];
+    if (tx->payload_id == 0) continue;
+
+    for (uint8_t c = 0; c < tx->chunk_count && mt_txq_space() >= CHUNK_FRAME_SIZE; c++) {
+      if (!(tx->to_send & (1UL << c))) continue;
+      if (!send_chunk(tx, c)) break;
+      tx->to_send &= ~(1UL << c);
+      tx->last_at = now;
+    }
+
+    if (tx->to_send == 0) {
+      if (tx->dest == BROADCAST_ADDR) {
+        send_done(tx, MT_CHUNK_SENT);
+      } else if (now - tx->last_at >= CHUNK_ACK_TIMEOUT_MS) {
+        send_done(tx, MT_CHUNK_TIMED_OUT);
+      }
+    }
+  }
+
+  for (int i = 0; i < MT_CHUNK_RX_SLOTS; i++) {
+    mt_chunk_rx_t *rx = &chunk_rx[i];
+    if (rx->payload_id == 0 || now - rx->last_at < CHUNK_GAP_MS) continue;
+    if (rx->requests_left == 0 || rx->to == BROADCAST_ADDR) {
+      d("Giving up on large message %u from %x", rx->payload_id, rx->from);
+      rx->payload_id = 0;
+      continue;
+    }
+    rx->requests_left--;
+    rx->last_at = now;
+    send_response(rx);
+  }
+}
+
+void mt_chunk_deadline(uint32_t * next_due) {
+  for (int i = 0; i < MT_CHUNK_TX_SLOTS; i++) {
+    mt_chunk_tx_t *tx = &chunk_tx[i];
+    if (tx->payload_id != 0 && tx->to_send == 0) mt_due_at(next_due, tx->last_at + CHUNK_ACK_TIMEOUT_MS);
+  }
+  for (int i = 0; i < MT_CHUNK_RX_SLOTS; i++) {
+    mt_chunk_rx_t *rx = &chunk_rx[i];
+    if (rx->payload_id != 0) mt_due_at(next_due, rx->last_at + CHUNK_GAP_MS);
+  }
+}
+
+// Whether packets on the chunk ports are worth decoding
+bool mt_chunk_wanted(meshtastic_PortNum port) {
+  if (port == MT_CHUNK_PORT) return large_message_callback != NULL;
+  if (port == MT_CHUNK_RESPONSE_PORT) {
+    for (int i = 0; i < MT_CHUNK_TX_SLOTS; i++) {
+      if (chunk_tx[i].payload_id != 0) return true;
+    }
+  }
+  return false;
+}
+
+static void handle_chunk(uint32_t now, const meshtastic_MeshPacket * packet) {
+  const meshtastic_Data_payload_t *payload = &packet->decoded.payload;
+  pb_istream_t stream = pb_istream_from_buffer(payload->bytes, payload->size);
+  uint32_t payload_id = 0, count = 0, index = 0, value;
+  bool have_chunk = false;
+  size_t chunk_at = 0;  // Where the chunk's data starts in the payload
+  uint32_t chunk_len = 0;
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_ChunkedPayload_payload_chunk_tag && wire_type == PB_WT_STRING) {
+      if (!pb_decode_varint32(&stream, &chunk_len)) return;
+      have_chunk = true;
+      chunk_at = payload->size - stream.bytes_left;
+      if (!pb_read(&stream, NULL, chunk_len)) return;  // Checks it's all there
+    } else if (wire_type == PB_WT_VARINT && tag <= meshtastic_ChunkedPayload_chunk_index_tag) {
+      if (!pb_decode_varint32(&stream, &value)) return;
+      if (tag == meshtastic_ChunkedPayload_payload_id_tag) payload_id = value;
+      if (tag == meshtastic_ChunkedPayload_chunk_count_tag) count = value;
+      if (tag == meshtastic_ChunkedPayload_chunk_index_tag) index = value;
+    } else if (!pb_skip_field(&stream, wire_type)) {
+      return;
+    }
+  }
+  if (!eof || !have_chunk || payload_id == 0 || count == 0 || count > MT_CHUNK_MAX_COUNT || index >= count) return;
+  if (chunk_len != CHUNK_DATA_SIZE && index != count - 1) return;  // Only the last can be short
+  if (chunk_len > CHUNK_DATA_SIZE) return;
+
+  for (int i = 0; i < CHUNK_DONE_LEN; i++) {
+    if (chunk_done[i].payload_id == payload_id && chunk_done[i].from == packet->from) {
+      d("Dropping a late chunk of large message %u from %x", payload_id, packet->from);
+      return;
+    }
+  }
+
+  mt_chunk_rx_t *rx = NULL;
+  for (int i = 0; i < MT_CHUNK_RX_SLOTS; i++) {
+    if (chunk_rx[i].payload_id == payload_id && chunk_rx[i].from == packet->from) rx = &chunk_rx[i];
+  }
+  if (rx == NULL) {
+    for (int i = 0; i < MT_CHUNK_RX_SLOTS && rx == NULL; i++) {
+      if (chunk_rx[i].payload_id == 0) rx = &chunk_rx[i];
+    }
+    if (rx == NULL) {
+      d("No room to reassemble large message %u from %x", payload_id, packet->from);
+      return;
+    }
+    rx->payload_id = payload_id;
+    rx->from = packet->from;
+    rx->to = packet->to;
+    rx->channel = packet->channel;
+    rx->chunk_count = count;
+    rx->requests_left = CHUNK_MAX_REQUESTS;
+    rx->received = 0;
+    rx->len = 0;
+  }
+  if (count != rx->chunk_count) return;
+
+  memcpy(rx->data + index * CHUNK_DATA_SIZE, payload->bytes + chunk_at, chunk_len);
+  rx->received |= 1UL << index;
+  rx->last_at = now;
+  if (index == count - 1) rx->len = index * CHUNK_DATA_SIZE + chunk_len;
+
+  if (rx->received != all_chunks(rx->chunk_count)) {
+    // The last chunk is here but some before it aren't, so there's no point waiting for them
+    if (index == count - 1 && rx->to != BROADCAST_ADDR && rx->requests_left > 0) {
+      rx->requests_left--;
+      send_response(rx);
+    }
+    return;
+  }
+
+  if (rx->to != BROADCAST_ADDR) send_response(rx);
+  chunk_done[chunk_done_next].payload_id = rx->payload_id;
+  chunk_done[chunk_done_next].from = rx->from;
+  chunk_done_next = (chunk_done_next + 1) % CHUNK_DONE_LEN;
+  rx->payload_id = 0;
+  mt_bytes_t data;
+  data.data = rx->data;
+  data.len = rx->len;
+  large_message_callback(rx->from, rx->to, rx->channel, data);
+}
+
+// Returns false if the response wasn't for any message we're sending
+static bool handle_response(uint32_t now, const meshtastic_MeshPacket * packet) {
+  const meshtastic_Data_payload_t *payload = &packet->decoded.payload;
+  pb_istream_t stream = pb_istream_from_buffer(payload->bytes, payload->size);
+  uint32_t payload_id = 0, value, resend = 0;
+  bool accepted = false;
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_ChunkedPayloadResponse_payload_id_tag && wire_type == PB_WT_VARINT) {
+      if (!pb_decode_varint32(&stream, &payload_id)) return false;
+    } else if (tag == meshtastic_ChunkedPayloadResponse_accept_transfer_tag && wire_type == PB_WT_VARINT) {
+      if (!pb_decode_varint32(&stream, &value)) return false;
+      accepted = value != 0;
+    } else if (tag == meshtastic_ChunkedPayloadResponse_resend_chunks_tag && wire_type == PB_WT_STRING) {
+      // The chunk indexes may come packed or one field each
+      pb_istream_t sub;
+      if (!pb_make_string_substream(&stream, &sub)) return false;
+      pb_wire_type_t sub_type;
+      uint32_t sub_tag;
+      bool sub_eof;
+      while (pb_decode_tag(&sub, &sub_type, &sub_tag, &sub_eof)) {
+        if (sub_tag == meshtastic_resend_chunks_chunks_tag && sub_type == PB_WT_STRING) {
+          pb_istream_t packed;
+          if (!pb_make_string_substream(&sub, &packed)) return false;
+          while (packed.bytes_left > 0 && pb_decode_varint32(&packed, &value)) {
+            if (value < 32) resend |= 1UL << value;
+          }
+          if (!pb_close_string_substream(&sub, &packed)) return false;
+        } else if (sub_tag == meshtastic_resend_chunks_chunks_tag && sub_type == PB_WT_VARINT) {
+          if (!pb_decode_varint32(&sub, &value)) return false;
+          if (value < 32) resend |= 1UL << value;
+        } else if (!pb_skip_field(&sub, sub_type)) {
+          return false;
+        }
+      }
+      if (!pb_close_string_substream(&stream, &sub)) return false;
+    } else if (!pb_skip_field(&stream, wire_type)) {
+      return false;
+    }
+  }
+
+  for (int i = 0; i < MT_CHUNK_TX_SLOTS; i++) {
+    mt_chunk_tx_t *tx = &chunk_tx[i];
+    if (tx->payload_id == 0 || tx->payload_id != payload_id || tx->dest != packet->from) continue;
+    if (accepted) {
+      send_done(tx, MT_CHUNK_DELIVERED);
+    } else {
+      d("Resending chunks %x of large message %u", resend, payload_id);
+      tx->to_send |= resend & all_chunks(tx->chunk_count);
+      tx->last_at = now;
+      mt_chunk_service(now);
+    }
+    return true;
+  }
+  return false;
+}
+
+// Returns true if the packet was a chunk or a chunk response, which the app doesn't see as such.
+// Chunks are only taken once the app has set a large message callback, and responses only if they
+// answer a message it's sending; otherwise they go to the app like packets on any other port.
+bool mt_chunk_handle_packet(uint32_t now, const meshtastic_MeshPacket * packet) {
+  if (packet->which_payload_variant != meshtastic_MeshPacket_decoded_tag) return false;
+  if (packet->decoded.portnum == MT_CHUNK_PORT) {
+    if (large_message_callback == NULL) return false;
+    handle_chunk(now, packet);
+    return true;
+  }
+  if (packet->decoded.portnum == MT_CHUNK_RESPONSE_PORT) return handle_response(now, packet);
+  return false;
+}
+#else
+void set_large_message_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, mt_bytes_t data)) {}
+
+void set_large_send_callback(void (*callback)(uint32_t payload_id, mt_chunk_result_t result)) {}
+
+bool mt_send_large(const uint8_t * data, size_t len, uint32_t dest, uint8_t channel_index, uint32_t * payload_id) {
+  return false;
+}
+
+void mt_chunk_service(uint32_t now) {}
+
+void mt_chunk_deadline(uint32_t * next_due) {}
+
+bool mt_chunk_wanted(meshtastic_PortNum port) {
+  return false;
+}
+
+bool mt_chunk_handle_packet(uint32_t now, const meshtastic_MeshPacket * packet) {
+  return false;
+}
+#endif
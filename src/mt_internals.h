@@ -3,7 +3,72 @@
 
 #include "Meshtastic.h"
 
-#ifdef MT_DEBUGGING
+#ifdef MT_TRACING
+// Instead of formatting log lines, send a binary record holding just an ID for the call site and
+// the raw argument values. The format strings never make it into the build; bin/decode-trace.py
+// finds them in the source by the same ID and does the formatting on the host.
+//
+// The ID is an FNV-1a hash of the source file's name and the line number, worked out at compile
+// time.
+
+constexpr uint32_t mt_trace_fnv(const char * s, uint32_t h) {
+  return *s ? mt_trace_fnv(s + 1, (h ^ (uint8_t)*s) * 16777619UL) : h;
+}
+
+constexpr const char * mt_trace_basename(const char * s, const char * base) {
+  return *s ? mt_trace_basename(s + 1, *s == '/' || *s == '\\' ? s + 1 : base) : base;
+}
+
+constexpr uint32_t mt_trace_id(const char * file, uint32_t line) {
+  return ((mt_trace_fnv(mt_trace_basename(file, file), 2166136261UL) ^ (line & 0xff)) * 16777619UL
+          ^ ((line >> 8) & 0xff)) * 16777619UL;
+}
+
+// Forces the ID to be worked out by the compiler, not at run time
+template <uint32_t id> struct mt_trace_const { static const uint32_t value = id; };
+
+void mt_trace_begin(uint32_t id);
+void mt_trace_end();
+
+// Each argument goes out as a tag byte giving its type and size, then its bytes, little-endian
+void mt_trace_put(bool v);
+void mt_trace_put(char v);
+void mt_trace_put(signed char v);
+void mt_trace_put(unsigned char v);
+void mt_trace_put(short v);
+void mt_trace_put(unsigned short v);
+void mt_trace_put(int v);
+void mt_trace_put(unsigned int v);
+void mt_trace_put(long v);
+void mt_trace_put(unsigned long v);
+void mt_trace_put(long long v);
+void mt_trace_put(unsigned long long v);
+void mt_trace_put(float v);
+void mt_trace_put(double v);
+void mt_trace_put(const char * v);
+void mt_trace_put(const void * v);
+void mt_trace_put(...);  // Anything else, such as a struct, goes out as just a tag
+
+inline void mt_trace_args() {}
+
+template <typename T, typename... Rest>
+inline void mt_trace_args(T v, Rest... rest) {
+  mt_trace_put(v);
+  mt_trace_args(rest...);
+}
+
+#define MT_TRACE(...) do { \
+    mt_trace_begin(mt_trace_const<mt_trace_id(__FILE__, __LINE__)>::value); \
+    mt_trace_args(__VA_ARGS__); \
+    mt_trace_end(); \
+  } while (0)
+
+#define mt_log(fmt, ...) MT_TRACE(__VA_ARGS__)
+#endif
+
+#if defined(MT_DEBUGGING) && defined(MT_TRACING)
+#define d(fmt, ...) MT_TRACE(__VA_ARGS__)
+#elif defined(MT_DEBUGGING)
 #define d(...) _d(__VA_ARGS__)
 #else
 #define d(...) do {} while (0) 
@@ -11,18 +76,90 @@
 
 void _d(const char * fmt, ...);
 
+// Queue a line for Serial without waiting for it to be written. mt_poll() drains the queue.
+#ifndef MT_TRACING
+void mt_log(const char * fmt, ...);
+void mt_logv(const char * fmt, va_list ap);
+#endif
+void mt_log_drain();
+bool mt_log_pending();
+
+// Magic number at the start of all MT packets
+#define MT_MAGIC_0 0x94
+#define MT_MAGIC_1 0xc3
+
+// The header is the magic number plus a 16-bit payload-length field
+#define MT_HEADER_SIZE 4
+
+// The largest ToRadio payload we'll encode, and (unless MT_STREAMING_DECODE is defined) the
+// largest FromRadio payload we'll receive. Lowering it saves RAM, at the cost of skipping any bigger
+// frames the radio sends, such as long text messages.
+#ifndef PB_BUFSIZE
+#define PB_BUFSIZE 512
+#endif
+
 extern bool mt_wifi_mode;
 extern bool mt_serial_mode;
 
+// What the radio has told us about itself, as handled in mt_protocol.cpp
+extern meshtastic_Channel channels[MT_MAX_CHANNELS];
+extern uint8_t channels_seen;
+extern meshtastic_Config_LoRaConfig lora_config;
+extern bool have_lora_config;
+
+bool handle_my_info(meshtastic_MyNodeInfo *myNodeInfo);
+bool handle_node_info(meshtastic_NodeInfo *nodeInfo);
+void node_from_info(const meshtastic_NodeInfo * info, mt_node_t * node);
+bool handle_config_tag(meshtastic_Config *config);
+bool handle_channel_tag(meshtastic_Channel *channel);
+
 bool mt_wifi_loop(uint32_t now);
 bool mt_serial_loop();
 
 size_t mt_wifi_check_radio(char * buf, size_t space_left);
 size_t mt_serial_check_radio(char * buf, size_t space_left);
 
+size_t mt_wifi_read_radio(char * buf, size_t len, uint32_t timeout);
+size_t mt_serial_read_radio(char * buf, size_t len, uint32_t timeout);
+
 bool mt_wifi_send_radio(const char * buf, size_t len);
 bool mt_serial_send_radio(const char * buf, size_t len);
 
 void mt_wifi_reset_idle_timeout(uint32_t now);
+uint32_t mt_wifi_next_deadline();
+
+void mt_due_at(uint32_t * next_due, uint32_t at);
+
+bool mt_send_radio(const char * buf, size_t len);
+
+pb_byte_t * mt_txq_reserve(size_t * room, bool want_ack);
+void mt_txq_overflow();
+size_t mt_txq_space();
+uint8_t mt_txq_priority(meshtastic_PortNum port, bool want_ack);
+void mt_txq_commit(pb_byte_t * frame, size_t len, uint32_t packet_id, uint32_t dest, bool want_ack,
+                   uint8_t priority, uint32_t now);
+void mt_txq_service(uint32_t now);
+void mt_txq_handle_status(uint32_t now, const meshtastic_QueueStatus * status);
+void mt_txq_handle_packet(uint32_t now, const meshtastic_MeshPacket * packet);
+bool mt_txq_awaiting_ack();
+void mt_txq_deadline(uint32_t * next_due);
+
+void mt_airtime_set_lora(const meshtastic_Config_LoRaConfig * lora);
+void mt_airtime_handle_node_info(const meshtastic_NodeInfo * nodeInfo);
+void mt_airtime_handle_packet(const meshtastic_MeshPacket * packet);
+bool mt_airtime_clear(uint8_t priority, size_t len, uint32_t queued_at, uint32_t now);
+void mt_airtime_count_held();
+void mt_airtime_sent(size_t len);
+
+void mt_chunk_service(uint32_t now);
+void mt_chunk_deadline(uint32_t * next_due);
+bool mt_chunk_wanted(meshtastic_PortNum port);
+bool mt_chunk_handle_packet(uint32_t now, const meshtastic_MeshPacket * packet);
+
+// Store everything in node as the node's record, unless it isn't worth pushing another node out for
+void mt_nodedb_put(const mt_node_t * node);
+bool mt_nodedb_wanted(meshtastic_PortNum port);
+void mt_nodedb_heard(uint32_t from, uint32_t rx_time, float rx_snr);
+void mt_nodedb_handle_packet(const meshtastic_MeshPacket * packet);
 
 #endif
@@ -0,0 +1,258 @@
+#include "mt_internals.h"
+
+// Log lines are formatted into a ring buffer, and mt_log_drain() writes out only as much of it as
+// Serial can take without blocking. At 9600 baud a single line used to hold up the whole loop for
+// tens of milliseconds while it was printed, long enough for the radio to overflow our input
+// buffer. If the ring fills up, whole lines are dropped (and counted) rather than waited for.
+//
+// This relies on Serial.availableForWrite(), which some cores don't implement (it always returns
+// 0). There, define MT_LOG_BLOCKING to print each line straight away, as before.
+//
+// With MT_TRACING, binary trace records (see mt_internals.h) go through the ring instead of lines.
+
+#ifndef MT_LOG_BUFSIZE
+#define MT_LOG_BUFSIZE 256
+#endif
+
+// Longer lines are cut short
+#define LOG_LINE_MAX 128
+
+char log_line[LOG_LINE_MAX];
+
+#ifdef MT_TRACING
+// Each record is framed by zero bytes, with the record itself COBS-encoded so that it has none:
+//
+//   0x00, COBS(id[4], args..., check), 0x00
+//
+// where check makes the XOR of all the bytes before COBS encoding come to zero. Text on Serial
+// never has a zero byte in it, so bin/decode-trace.py can pick the records out of whatever else the
+// sketch prints.
+#define TRACE_BODY_MAX 64
+
+// Argument tags. The low nibble is the size in bytes.
+#define TRACE_UNSIGNED 0x10
+#define TRACE_SIGNED 0x20
+#define TRACE_FLOAT 0x30
+#define TRACE_STRING 0x40  // Followed by a length byte, then that many chars
+#define TRACE_POINTER 0x50
+#define TRACE_OTHER 0x60  // A value of some other type, which isn't sent
+
+// Strings longer than this are cut short
+#define TRACE_STRING_MAX 32
+
+// The ID of the record saying how many were dropped, with the count as its one argument
+#define TRACE_DROPPED_ID 0
+
+uint8_t trace_body[TRACE_BODY_MAX];
+size_t trace_len = 0;
+bool trace_full = false;  // Once an argument doesn't fit, leave off the rest too
+#endif
+
+#ifndef MT_LOG_BLOCKING
+char log_buf[MT_LOG_BUFSIZE];
+size_t log_head = 0;  // Index of the oldest byte not yet written out
+size_t log_size = 0;
+uint32_t log_dropped = 0;          // Lines dropped since we last said so
+uint32_t log_dropped_total = 0;
+
+static size_t log_space() {
+  return MT_LOG_BUFSIZE - log_size;
+}
+
+static void log_put(const char * s, size_t len) {
+  size_t tail = (log_head + log_size) % MT_LOG_BUFSIZE;
+  size_t first = MT_LOG_BUFSIZE - tail;
+  if (first > len) first = len;
+  memcpy(log_buf + tail, s, first);
+  memcpy(log_buf, s + first, len - first);
+  log_size += len;
+}
+
+static size_t dropped_note(char * note, size_t size);
+
+// Queue a whole line or record, or drop it if there's no room
+static void log_out(const char * s, size_t len) {
+  if (log_dropped > 0) {
+    // Say how many lines went missing, as soon as there's room to
+    char note[40];
+    size_t n = dropped_note(note, sizeof(note));
+    if (n + len <= log_space()) {
+      log_put(note, n);
+      log_dropped = 0;
+    }
+  }
+  if (log_dropped > 0 || len > log_space()) {
+    log_dropped++;
+    log_dropped_total++;
+    return;
+  }
+  log_put(s, len);
+}
+
+void mt_log_drain() {
+  int room = Serial.availableForWrite();
+  while (log_size > 0 && room > 0) {
+    size_t n = MT_LOG_BUFSIZE - log_head;  // Up to the end of the ring
+    if (n > log_size) n = log_size;
+    if (n > (size_t)room) n = room;
+    n = Serial.write((const uint8_t *)log_buf + log_head, n);
+    if (n == 0) return;
+    log_head = (log_head + n) % MT_LOG_BUFSIZE;
+    log_size -= n;
+    room -= n;
+  }
+}
+
+bool mt_log_pending() {
+  return log_size > 0;
+}
+
+uint32_t mt_log_dropped_lines() {
+  return log_dropped_total;
+}
+#else
+static void log_out(const char * s, size_t len) {
+  Serial.write((const uint8_t *)s, len);
+  Serial.flush();
+}
+
+void mt_log_drain() {}
+
+bool mt_log_pending() {
+  return false;
+}
+
+uint32_t mt_log_dropped_lines() {
+  return 0;
+}
+#endif
+
+#ifndef MT_TRACING
+#ifndef MT_LOG_BLOCKING
+static size_t dropped_note(char * note, size_t size) {
+  int n = snprintf(note, size, "[%lu log lines dropped]\r\n", (unsigned long)log_dropped);
+  return n > 0 ? n : 0;
+}
+#endif
+
+void mt_logv(const char * fmt, va_list ap) {
+  // Leave room for the line ending
+  int n = vsnprintf(log_line, sizeof(log_line) - 2, fmt, ap);
+  if (n < 0) return;
+  if ((size_t)n >= sizeof(log_line) - 2) n = sizeof(log_line) - 3;
+  log_line[n++] = '\r';
+  log_line[n++] = '\n';
+  log_out(log_line, n);
+}
+
+void mt_log(const char * fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  mt_logv(fmt, ap);
+  va_end(ap);
+}
+
+void _d(const char * fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  mt_logv(fmt, ap);
+  va_end(ap);
+}
+#else
+// Add bytes to the record, if they fit along with the check byte
+static bool trace_bytes(const void * v, size_t len) {
+  if (trace_full || trace_len + len > sizeof(trace_body) - 1) {
+    trace_full = true;
+    return false;
+  }
+  memcpy(trace_body + trace_len, v, len);
+  trace_len += len;
+  return true;
+}
+
+// Integers and floats are little-endian on every board we run on, so go out as they are
+static void trace_value(uint8_t tag, const void * v, size_t len) {
+  uint8_t buf[1 + sizeof(uintmax_t)];
+  buf[0] = tag | len;
+  memcpy(buf + 1, v, len);
+  trace_bytes(buf, 1 + len);
+}
+
+// Frame the body and its check byte, COBS-encoded, into out. Returns the frame's length.
+static size_t trace_frame(uint8_t * body, size_t len, char * out) {
+  uint8_t check = 0;
+  for (size_t i = 0; i < len; i++) check ^= body[i];
+  body[len++] = check;
+
+  size_t n = 0;
+  out[n++] = 0;
+  size_t code_at = n++;
+  uint8_t code = 1;
+  for (size_t i = 0; i < len; i++) {
+    if (body[i] == 0) {
+      out[code_at] = code;
+      code_at = n++;
+      code = 1;
+    } else {
+      out[n++] = body[i];
+      code++;
+    }
+  }
+  out[code_at] = code;
+  out[n++] = 0;
+  return n;
+}
+
+#ifndef MT_LOG_BLOCKING
+static size_t dropped_note(char * note, size_t size) {
+  uint8_t body[10];
+  uint32_t id = TRACE_DROPPED_ID;
+  memcpy(body, &id, 4);
+  body[4] = TRACE_UNSIGNED | 4;
+  memcpy(body + 5, &log_dropped, 4);
+  return trace_frame(body, 9, note);
+}
+#endif
+
+void mt_trace_begin(uint32_t id) {
+  trace_len = 0;
+  trace_full = false;
+  trace_bytes(&id, sizeof(id));
+}
+
+void mt_trace_end() {
+  log_out(log_line, trace_frame(trace_body, trace_len, log_line));
+}
+
+void mt_trace_put(bool v) { uint8_t b = v; trace_value(TRACE_UNSIGNED, &b, 1); }
+void mt_trace_put(char v) { trace_value(TRACE_SIGNED, &v, 1); }
+void mt_trace_put(signed char v) { trace_value(TRACE_SIGNED, &v, sizeof(v)); }
+void mt_trace_put(unsigned char v) { trace_value(TRACE_UNSIGNED, &v, sizeof(v)); }
+void mt_trace_put(short v) { trace_value(TRACE_SIGNED, &v, sizeof(v)); }
+void mt_trace_put(unsigned short v) { trace_value(TRACE_UNSIGNED, &v, sizeof(v)); }
+void mt_trace_put(int v) { trace_value(TRACE_SIGNED, &v, sizeof(v)); }
+void mt_trace_put(unsigned int v) { trace_value(TRACE_UNSIGNED, &v, sizeof(v)); }
+void mt_trace_put(long v) { trace_value(TRACE_SIGNED, &v, sizeof(v)); }
+void mt_trace_put(unsigned long v) { trace_value(TRACE_UNSIGNED, &v, sizeof(v)); }
+void mt_trace_put(long long v) { trace_value(TRACE_SIGNED, &v, sizeof(v)); }
+void mt_trace_put(unsigned long long v) { trace_value(TRACE_UNSIGNED, &v, sizeof(v)); }
+void mt_trace_put(float v) { trace_value(TRACE_FLOAT, &v, sizeof(v)); }
+void mt_trace_put(double v) { trace_value(TRACE_FLOAT, &v, sizeof(v)); }
+
+void mt_trace_put(const void * v) {
+  uintptr_t p = (uintptr_t)v;
+  trace_value(TRACE_POINTER, &p, sizeof(p));
+}
+
+void mt_trace_put(...) {
+  trace_value(TRACE_OTHER, "", 0);
+}
+
+void mt_trace_put(const char * v) {
+  if (v == NULL) v = "(null)";
+  size_t len = strnlen(v, TRACE_STRING_MAX);
+  if (trace_len + 2 + len > sizeof(trace_body) - 1) trace_full = true;
+  uint8_t head[2] = {TRACE_STRING, (uint8_t)len};
+  if (trace_bytes(head, 2)) trace_bytes(v, len);
+}
+#endif
@@ -0,0 +1,506 @@
+#include "mt_internals.h"
+
+// Everything the radio has told us about the nodes in the mesh, kept in a fixed-size table and
+// looked up by node number through an open-addressing hash index (linear probing, kept at most half
+// full), so finding a node takes the same time however many we know about.
+//
+// The records themselves are kept packed at the front of nodes[], in no particular order, so they
+// can be walked by position. The index holds one more than each record's position, or 0 for an
+// empty bucket.
+//
+// Once the table is full, a node we hear about pushes out the one heard from least recently (never
+// our own), unless it was heard from even less recently itself.
+//
+// Between node reports, records are kept up to date from the mesh's own traffic: the User,
+// Position and DeviceMetrics that nodes broadcast, and the time and SNR of every packet we get.
+// Packets nothing else wants are only peeked at for the latter, not decoded.
+
+// Records are kept compact, since a big mesh has hundreds of nodes and a SAMD21 has 32 KB of RAM.
+// Positions stay in the 1e-7 degree units the radio sends, metrics are rounded to what's worth
+// showing, and names are kept in a shared pool, once however many nodes use them. Most nodes keep
+// the names and ID the firmware made up from their node number, so those take no room at all.
+// mt_nodedb_find() and mt_nodedb_at() turn a record back into an mt_node_t.
+//
+// On a 32-bit board, each node takes (in bytes, the last column being what it took when records
+// were whole mt_node_ts):
+//
+//   nodes  record  index  names  total  before
+//     100    44     5.1    24     73     125
+//     500    44     4.1    24     72     124
+//    1000    44     4.1    24     72     124
+//
+// where the names column is the pool's default size per node (MT_NODEDB_NAMES_SIZE), which is
+// enough for every node to have a long name of a dozen characters and a short name of four of its
+// own. mt_nodedb_names_lost() says if it turns out not to be.
+
+// How many nodes we can keep. None unless the app asks for the table, as it costs about 70 bytes
+// of RAM a node.
+#ifndef MT_NODEDB_SIZE
+#define MT_NODEDB_SIZE 0
+#endif
+
+// Bytes of pool for the names. Each distinct name takes three bytes more than its length. Once it's
+// full, nodes with new names get empty ones until some are freed.
+#ifndef MT_NODEDB_NAMES_SIZE
+#define MT_NODEDB_NAMES_SIZE (MT_NODEDB_SIZE * 24)
+#endif
+
+#if MT_NODEDB_SIZE > 0
+// The smallest power of two at least twice as big as n
+constexpr uint16_t nodedb_buckets(uint16_t n, uint16_t b = 1) {
+  return b >= 2 * n ? b : nodedb_buckets(n, b * 2);
+}
+
+#define NODEDB_BUCKETS nodedb_buckets(MT_NODEDB_SIZE)
+
+static_assert(MT_NODEDB_NAMES_SIZE < 0xFFFF, "Name offsets have to fit in 16 bits");
+
+// Which of a node's names
+#define NAME_ID 0
+#define NAME_LONG 1
+#define NAME_SHORT 2
+#define NAME_COUNT 3
+
+#define NO_NAME 0xFFFF
+#define NO_POSITION INT32_MIN
+#define NO_METRIC 0xFFFF
+#define NO_SNR INT8_MIN
+
+#define FLAG_MINE 0x01
+#define FLAG_USER 0x02
+#define FLAG_DEFAULT_NAME 0x04  // Shifted left by NAME_ID and so on: the name is the made-up one
+
+typedef struct {
+  uint32_t node_num;
+  uint32_t last_heard_from;
+  uint32_t last_heard_position;
+  uint32_t time_of_last_position;
+  int32_t latitude_i;  // 1e-7 degrees, or NO_POSITION
+  int32_t longitude_i;
+  uint16_t name[NAME_COUNT];  // Offsets into names[], or NO_NAME
+  uint16_t ground_speed;
+  uint16_t voltage;  // mV, or NO_METRIC
+  uint16_t channel_utilization;  // Hundredths of a percent, or NO_METRIC
+  uint16_t air_util_tx;
+  int8_t altitude;
+  uint8_t battery_level;
+  int8_t snr;  // Quarter dB, the radio's own resolution, or NO_SNR
+  uint8_t flags;
+} node_rec_t;
+
+node_rec_t nodes[MT_NODEDB_SIZE];
+uint16_t node_count = 0;
+uint16_t node_index[NODEDB_BUCKETS];
+
+// Each name is a 16-bit reference count (low byte first), a length, then that many chars with no
+// NUL. Every node refers to a name at most three times (and one more while a name is replaced), so
+// the count can't overflow.
+uint8_t names[MT_NODEDB_NAMES_SIZE];
+uint16_t names_used = 0;
+uint32_t names_lost = 0;  // Names dropped because the pool was full
+
+static_assert(MT_NODEDB_SIZE * NAME_COUNT < 0xFFFF, "Name reference counts have to fit in 16 bits");
+
+#define NAME_HEADER 3
+
+static uint16_t name_refs(uint16_t o) {
+  return names[o] | names[o + 1] << 8;
+}
+
+static void set_name_refs(uint16_t o, uint16_t refs) {
+  names[o] = refs & 0xFF;
+  names[o + 1] = refs >> 8;
+}
+
+static const size_t name_max[NAME_COUNT] = {MAX_USER_ID_LEN, MAX_LONG_NAME_LEN, MAX_SHORT_NAME_LEN};
+
+// The ID and names the firmware gives a node until its owner picks some
+static void default_name(uint8_t which, uint32_t node_num, char * buf, size_t size) {
+  unsigned long num = node_num;
+  switch (which) {
+    case NAME_ID: snprintf(buf, size, "!%08lx", num); break;
+    case NAME_LONG: snprintf(buf, size, "Meshtastic %04lx", num & 0xFFFF); break;
+    case NAME_SHORT: snprintf(buf, size, "%04lx", num & 0xFFFF); break;
+  }
+}
+
+// A new reference to this name in the pool, added if need be
+static uint16_t name_intern(const char * s, size_t max) {
+  size_t len = strnlen(s, max);
+  if (len == 0) return NO_NAME;
+  uint16_t o = 0;
+  while (o < names_used) {
+    if (names[o + 2] == len && memcmp(names + o + NAME_HEADER, s, len) == 0) {
+      set_name_refs(o, name_refs(o) + 1);
+      return o;
+    }
+    o += NAME_HEADER + names[o + 2];
+  }
+  if (names_used + NAME_HEADER + len > MT_NODEDB_NAMES_SIZE) {
+    d("No room left for node names");
+    names_lost++;
+    return NO_NAME;
+  }
+  set_name_refs(o, 1);
+  names[o + 2] = len;
+  memcpy(names + o + NAME_HEADER, s, len);
+  names_used += NAME_HEADER + len;
+  return o;
+}
+
+// Drop a reference to a name, and once nothing refers to it, close up the gap
+static void name_release(uint16_t o) {
+  if (o == NO_NAME) return;
+  uint16_t refs = name_refs(o) - 1;
+  set_name_refs(o, refs);
+  if (refs > 0) return;
+  uint16_t size = NAME_HEADER + names[o + 2];
+  memmove(names + o, names + o + size, names_used - o - size);
+  names_used -= size;
+  for (uint16_t i = 0; i < node_count; i++) {
+    for (uint8_t n = 0; n < NAME_COUNT; n++) {
+      if (nodes[i].name[n] != NO_NAME && nodes[i].name[n] > o) nodes[i].name[n] -= size;
+    }
+  }
+}
+
+static void set_name(node_rec_t * rec, uint8_t which, const char * s) {
+  char made_up[20];
+  default_name(which, rec->node_num, made_up, sizeof(made_up));
+  uint16_t o = NO_NAME;
+  if (strncmp(s, made_up, name_max[which]) == 0) {
+    rec->flags |= FLAG_DEFAULT_NAME << which;
+  } else {
+    rec->flags &= ~(FLAG_DEFAULT_NAME << which);
+    o = name_intern(s, name_max[which]);
+  }
+  uint16_t old = rec->name[which];
+  rec->name[which] = o;
+  name_release(old);  // Only now, as it may move the new one
+}
+
+// Copied out like the mt_node_t fields always were: up to max chars, NUL-padded
+static void get_name(const node_rec_t * rec, uint8_t which, char * buf) {
+  size_t max = name_max[which];
+  if (rec->flags & (FLAG_DEFAULT_NAME << which)) {
+    char made_up[20];
+    default_name(which, rec->node_num, made_up, sizeof(made_up));
+    strncpy(buf, made_up, max);
+    return;
+  }
+  memset(buf, 0, max);
+  uint16_t o = rec->name[which];
+  if (o != NO_NAME) memcpy(buf, names + o + NAME_HEADER, names[o + 2]);
+}
+
+static void clear_names(node_rec_t * rec) {
+  for (uint8_t n = 0; n < NAME_COUNT; n++) {
+    uint16_t old = rec->name[n];
+    rec->name[n] = NO_NAME;
+    name_release(old);
+  }
+  rec->flags &= ~(FLAG_USER | (FLAG_DEFAULT_NAME << NAME_ID) | (FLAG_DEFAULT_NAME << NAME_LONG)
+                  | (FLAG_DEFAULT_NAME << NAME_SHORT));
+}
+
+static void set_user(node_rec_t * rec, const char * id, const char * long_name, const char * short_name) {
+  rec->flags |= FLAG_USER;
+  set_name(rec, NAME_ID, id);
+  set_name(rec, NAME_LONG, long_name);
+  set_name(rec, NAME_SHORT, short_name);
+}
+
+// Metrics are kept in units of 1 / scale, to the nearest
+static uint16_t quantise(float v, float scale) {
+  if (isnan(v) || v < 0) return NO_METRIC;
+  float q = v * scale + 0.5f;
+  return q >= NO_METRIC ? NO_METRIC - 1 : (uint16_t)q;
+}
+
+static float unquantise(uint16_t q, float scale) {
+  return q == NO_METRIC ? NAN : q / scale;
+}
+
+static int8_t quantise_snr(float snr) {
+  if (isnan(snr)) return NO_SNR;
+  long q = lroundf(snr * 4);
+  return q < -127 ? -127 : q > 127 ? 127 : q;
+}
+
+// Node numbers are mostly random already, but some are small or made up, so mix them
+static uint16_t home_bucket(uint32_t node_num) {
+  uint32_t h = node_num * 2654435761UL;
+  return (h ^ (h >> 16)) & (NODEDB_BUCKETS - 1);
+}
+
+// The bucket holding this node, or else the empty one it would go in
+static uint16_t find_bucket(uint32_t node_num) {
+  uint16_t b = home_bucket(node_num);
+  while (node_index[b] != 0 && nodes[node_index[b] - 1].node_num != node_num) {
+    b = (b + 1) & (NODEDB_BUCKETS - 1);
+  }
+  return b;
+}
+
+// Empty a bucket, moving later entries in the same run back to fill the gap, so that no lookup
+// stops short of them
+static void remove_bucket(uint16_t b) {
+  uint16_t hole = b;
+  uint16_t i = b;
+  while (true) {
+    node_index[hole] = 0;
+    while (true) {
+      i = (i + 1) & (NODEDB_BUCKETS - 1);
+      if (node_index[i] == 0) return;
+      uint16_t home = home_bucket(nodes[node_index[i] - 1].node_num);
+      // Entries whose home is between the hole and here are still reachable where they are
+      bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+      if (!stays) break;
+    }
+    node_index[hole] = node_index[i];
+    hole = i;
+  }
+}
+
+// The record to overwrite to make room for a node last heard from at last_heard, if there is one
+static int nodedb_victim(uint32_t last_heard) {
+  int victim = -1;
+  for (uint16_t i = 0; i < node_count; i++) {
+    if (nodes[i].flags & FLAG_MINE) continue;
+    if (victim < 0 || nodes[i].last_heard_from < nodes[victim].last_heard_from) victim = i;
+  }
+  if (victim >= 0 && nodes[victim].last_heard_from > last_heard) return -1;
+  return victim;
+}
+
+static node_rec_t * nodedb_get(uint32_t node_num) {
+  uint16_t b = find_bucket(node_num);
+  return node_index[b] != 0 ? &nodes[node_index[b] - 1] : NULL;
+}
+
+// The node's record, made if need be, or NULL if it isn't worth pushing another node out for
+static node_rec_t * nodedb_upsert(uint32_t node_num, uint32_t last_heard) {
+  uint16_t b = find_bucket(node_num);
+  if (node_index[b] != 0) return &nodes[node_index[b] - 1];
+
+  uint16_t slot;
+  if (node_count < MT_NODEDB_SIZE) {
+    slot = node_count++;
+  } else {
+    int victim = nodedb_victim(last_heard);
+    if (victim < 0) return NULL;
+    slot = victim;
+    clear_names(&nodes[slot]);
+    remove_bucket(find_bucket(nodes[slot].node_num));
+    b = find_bucket(node_num);  // The bucket we had may have been filled by the shuffle
+  }
+
+  node_index[b] = slot + 1;
+  node_rec_t *rec = &nodes[slot];
+  memset(rec, 0, sizeof(*rec));
+  rec->node_num = node_num;
+  if (node_num == my_node_num) rec->flags |= FLAG_MINE;
+  rec->last_heard_from = last_heard;
+  for (uint8_t n = 0; n < NAME_COUNT; n++) rec->name[n] = NO_NAME;
+  rec->latitude_i = NO_POSITION;
+  rec->longitude_i = NO_POSITION;
+  rec->voltage = NO_METRIC;
+  rec->channel_utilization = NO_METRIC;
+  rec->air_util_tx = NO_METRIC;
+  rec->snr = NO_SNR;
+  return rec;
+}
+
+static void unpack(const node_rec_t * rec, mt_node_t * node) {
+  memset(node, 0, sizeof(*node));
+  node->node_num = rec->node_num;
+  node->is_mine = rec->flags & FLAG_MINE;
+  node->has_user = rec->flags & FLAG_USER;
+  if (node->has_user) {
+    get_name(rec, NAME_ID, node->user_id);
+    get_name(rec, NAME_LONG, node->long_name);
+    get_name(rec, NAME_SHORT, node->short_name);
+  }
+  if (rec->latitude_i != NO_POSITION) {
+    node->latitude = rec->latitude_i / 1e7;
+    node->longitude = rec->longitude_i / 1e7;
+  } else {
+    node->latitude = NAN;
+    node->longitude = NAN;
+  }
+  node->altitude = rec->altitude;
+  node->ground_speed = rec->ground_speed;
+  node->battery_level = rec->battery_level;
+  node->last_heard_from = rec->last_heard_from;
+  node->last_heard_position = rec->last_heard_position;
+  node->time_of_last_position = rec->time_of_last_position;
+  node->voltage = unquantise(rec->voltage, 1000);
+  node->channel_utilization = unquantise(rec->channel_utilization, 100);
+  node->air_util_tx = unquantise(rec->air_util_tx, 100);
+  node->snr = rec->snr == NO_SNR ? NAN : rec->snr / 4.0f;
+}
+
+void mt_nodedb_put(const mt_node_t * node) {
+  node_rec_t *rec = nodedb_upsert(node->node_num, node->last_heard_from);
+  if (rec == NULL) return;
+  rec->flags = (rec->flags & ~FLAG_MINE) | (node->is_mine ? FLAG_MINE : 0);
+  rec->last_heard_from = node->last_heard_from;
+  if (node->has_user) {
+    set_user(rec, node->user_id, node->long_name, node->short_name);
+  } else {
+    clear_names(rec);
+  }
+  if (!isnan(node->latitude)) {
+    rec->latitude_i = lround(node->latitude * 1e7);
+    rec->longitude_i = lround(node->longitude * 1e7);
+  } else {
+    rec->latitude_i = NO_POSITION;
+    rec->longitude_i = NO_POSITION;
+  }
+  rec->altitude = node->altitude;
+  rec->ground_speed = node->ground_speed;
+  rec->battery_level = node->battery_level;
+  rec->last_heard_position = node->last_heard_position;
+  rec->time_of_last_position = node->time_of_last_position;
+  rec->voltage = quantise(node->voltage, 1000);
+  rec->channel_utilization = quantise(node->channel_utilization, 100);
+  rec->air_util_tx = quantise(node->air_util_tx, 100);
+  rec->snr = quantise_snr(node->snr);
+}
+
+bool mt_nodedb_wanted(meshtastic_PortNum port) {
+  return port == meshtastic_PortNum_NODEINFO_APP || port == meshtastic_PortNum_POSITION_APP
+    || port == meshtastic_PortNum_TELEMETRY_APP;
+}
+
+// A packet from this node arrived at rx_time (0 if the radio doesn't know the time), this well
+void mt_nodedb_heard(uint32_t from, uint32_t rx_time, float rx_snr) {
+  if (from == 0 || from == my_node_num) return;  // Our own packets say nothing about the link
+  node_rec_t *rec = nodedb_upsert(from, rx_time);
+  if (rec == NULL) return;
+  if (rx_time != 0) rec->last_heard_from = rx_time;
+  rec->snr = quantise_snr(rx_snr);
+}
+
+static void update_user(node_rec_t * rec, const meshtastic_Data_payload_t * payload) {
+  meshtastic_User user = meshtastic_User_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(payload->bytes, payload->size);
+  if (!pb_decode(&stream, meshtastic_User_fields, &user)) return;
+  set_user(rec, user.id, user.long_name, user.short_name);
+}
+
+static void update_position(node_rec_t * rec, const meshtastic_Data_payload_t * payload) {
+  meshtastic_Position pos = meshtastic_Position_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(payload->bytes, payload->size);
+  if (!pb_decode(&stream, meshtastic_Position_fields, &pos)) return;
+  // Nodes that don't want to say where they are send positions without one
+  if (!pos.has_latitude_i || !pos.has_longitude_i) return;
+  rec->latitude_i = pos.latitude_i;
+  rec->longitude_i = pos.longitude_i;
+  if (pos.has_altitude) rec->altitude = pos.altitude;
+  if (pos.has_ground_speed) rec->ground_speed = pos.ground_speed;
+  rec->last_heard_position = pos.time;
+  rec->time_of_last_position = pos.timestamp;
+}
+
+// Only the DeviceMetrics out of a Telemetry are any use to us, so decode just those
+static void update_metrics(node_rec_t * rec, const meshtastic_Data_payload_t * payload) {
+  pb_istream_t stream = pb_istream_from_buffer(payload->bytes, payload->size);
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_Telemetry_device_metrics_tag && wire_type == PB_WT_STRING) {
+      meshtastic_DeviceMetrics m = meshtastic_DeviceMetrics_init_zero;
+      pb_istream_t sub;
+      if (!pb_make_string_substream(&stream, &sub)) return;
+      if (!pb_decode(&sub, meshtastic_DeviceMetrics_fields, &m)) return;
+      if (m.has_battery_level) rec->battery_level = m.battery_level;
+      if (m.has_voltage) rec->voltage = quantise(m.voltage, 1000);
+      if (m.has_channel_utilization) rec->channel_utilization = quantise(m.channel_utilization, 100);
+      if (m.has_air_util_tx) rec->air_util_tx = quantise(m.air_util_tx, 100);
+      return;
+    }
+    if (!pb_skip_field(&stream, wire_type)) return;
+  }
+}
+
+void mt_nodedb_handle_packet(const meshtastic_MeshPacket * packet) {
+  mt_nodedb_heard(packet->from, packet->rx_time, packet->rx_snr);
+  if (packet->which_payload_variant != meshtastic_MeshPacket_decoded_tag) return;
+
+  const meshtastic_Data_payload_t *payload = &packet->decoded.payload;
+  node_rec_t *rec;
+  switch (packet->decoded.portnum) {
+    case meshtastic_PortNum_NODEINFO_APP:
+      rec = nodedb_upsert(packet->from, packet->rx_time);
+      if (rec != NULL) update_user(rec, payload);
+      break;
+    case meshtastic_PortNum_POSITION_APP:
+      rec = nodedb_upsert(packet->from, packet->rx_time);
+      if (rec != NULL) update_position(rec, payload);
+      break;
+    case meshtastic_PortNum_TELEMETRY_APP:
+      rec = nodedb_upsert(packet->from, packet->rx_time);
+      if (rec != NULL) update_metrics(rec, payload);
+      break;
+    default:
+      break;
+  }
+}
+
+bool mt_nodedb_find(uint32_t node_num, mt_node_t * node) {
+  const node_rec_t *found = nodedb_get(node_num);
+  if (found == NULL) return false;
+  unpack(found, node);
+  return true;
+}
+
+uint16_t mt_nodedb_count() {
+  return node_count;
+}
+
+bool mt_nodedb_at(uint16_t i, mt_node_t * node) {
+  if (i >= node_count) return false;
+  unpack(&nodes[i], node);
+  return true;
+}
+
+void mt_nodedb_clear() {
+  node_count = 0;
+  memset(node_index, 0, sizeof(node_index));
+  names_used = 0;
+}
+
+uint32_t mt_nodedb_names_lost() {
+  return names_lost;
+}
+#else
+bool mt_nodedb_wanted(meshtastic_PortNum port) {
+  return false;
+}
+
+void mt_nodedb_heard(uint32_t from, uint32_t rx_time, float rx_snr) {}
+
+void mt_nodedb_handle_packet(const meshtastic_MeshPacket * packet) {}
+
+void mt_nodedb_put(const mt_node_t * node) {}
+
+bool mt_nodedb_find(uint32_t node_num, mt_node_t * node) {
+  return false;
+}
+
+uint16_t mt_nodedb_count() {
+  return 0;
+}
+
+bool mt_nodedb_at(uint16_t i, mt_node_t * node) {
+  return false;
+}
+
+void mt_nodedb_clear() {}
+
+uint32_t mt_nodedb_names_lost() {
+  return 0;
+}
+#endif
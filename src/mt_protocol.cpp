@@ -1,24 +1,116 @@
 #include "mt_internals.h"
 
-// Magic number at the start of all MT packets
-#define MT_MAGIC_0 0x94
-#define MT_MAGIC_1 0xc3
+// The radio never sends a frame with a longer payload than this, so a header claiming more is garbage
+#define MT_MAX_PAYLOAD 512
+
+// The buffer outgoing ToRadio frames that don't go through the TX queue are encoded into. It's
+// separate from the receive ring, so sending never disturbs a frame that's only partly arrived.
+// Since there's only one, and it's global, we have to make sure we're only ever doing one
+// encoding at a time.
+//
+// If MT_STREAMING_ENCODE is defined, those frames are instead encoded straight onto the connection
+// through a small chunk buffer. Their length is worked out first with a sizing pass, so the header
+// can go out ahead of them. That saves most of the buffer's RAM and gets the first bytes on the
+// wire sooner, at the cost of walking each message twice.
+#ifdef MT_STREAMING_ENCODE
+#define TX_CHUNK_SIZE 32
+pb_byte_t tx_buf[TX_CHUNK_SIZE];
+size_t tx_chunk_len = 0;
+#else
+pb_byte_t tx_buf[PB_BUFSIZE+4];
+#endif
 
-// The header is the magic number plus a 16-bit payload-length field
-#define MT_HEADER_SIZE 4
+// Bytes received from the radio are kept in a ring buffer, so that handling a frame only
+// advances the read cursor instead of shifting everything behind it to the front. It must
+// be able to hold at least one complete frame.
+//
+// If MT_STREAMING_DECODE is defined, frames that haven't completely arrived are instead decoded
+// straight off the connection as the decoder asks for bytes, so the ring only needs room for
+// headers and the odd burst of console text. That saves most of its RAM, at the cost of blocking
+// for as long as the rest of the frame takes to arrive (up to about half a second at 9600 baud).
+#ifdef MT_STREAMING_DECODE
+#define RX_BUFSIZE 64
+// Give up on a frame if the next byte of it takes longer than this to arrive
+#define STREAM_TIMEOUT_MS 100
+#else
+#define RX_BUFSIZE (PB_BUFSIZE + MT_HEADER_SIZE)
+#endif
+pb_byte_t rx_buf[RX_BUFSIZE];
+size_t rx_head = 0; // Index of the oldest unconsumed byte
+size_t rx_size = 0; // Number of bytes currently in the ring
+size_t rx_skip_left = 0; // Bytes still to be dropped from a frame too big for the ring
+mt_rx_stats_t rx_stats;
+
+// Where decoded frames go, chosen at build time with MT_DECODE_TARGET (see Meshtastic.h). Frames
+// are never decoded onto the stack, which used to hold a FromRadio plus a ToRadio per frame and
+// overflowed small AVR/SAMD stacks. That also lets a callback pin the frame with
+// mt_retain_frame() and keep using the payload views it was given after returning.
+//
+// Frame storage each strategy needs:
+//
+//   MT_DECODE_STATIC   Static RAM for a whole FromRadio.
+//   MT_DECODE_ARENA    A FromRadio's worth of the app's own memory, which it can reuse between calls.
+//   MT_DECODE_VARIANT  Static RAM for the largest variant we act on, MeshPacket. With MT_DEBUGGING
+//                      every variant is decoded in order to be printed, so MqttClientProxyMessage
+//                      is the largest.
+//
+// In every case the stack only holds nanopb's own decoder state. bin/stack-report.sh shows what
+// that comes to on a given board, and CI runs it for each one it builds for.
+#if MT_DECODE_TARGET == MT_DECODE_VARIANT
+// Only the payload variant itself is decoded, straight out of the frame, into one of these
+typedef union {
+  uint32_t config_complete_id;
+  bool rebooted;
+  meshtastic_MeshPacket packet;
+  meshtastic_MyNodeInfo my_info;
+  meshtastic_NodeInfo node_info;
+  meshtastic_QueueStatus queueStatus;
+  meshtastic_Config config;
+  meshtastic_Channel channel;
+#ifdef MT_DEBUGGING
+  meshtastic_LogRecord log_record;
+  meshtastic_ModuleConfig moduleConfig;
+  meshtastic_XModem xmodemPacket;
+  meshtastic_DeviceMetadata metadata;
+  meshtastic_MqttClientProxyMessage mqttClientProxyMessage;
+  meshtastic_FileInfo fileInfo;
+#endif
+} mt_variant_t;
+mt_variant_t rx_frame;
+#elif MT_DECODE_TARGET == MT_DECODE_ARENA
+meshtastic_FromRadio *rx_frame = NULL;
+#else
+meshtastic_FromRadio rx_frame;
+#endif
+bool rx_frame_in_callback = false; // True while rx_frame is being handed to callbacks
+bool rx_frame_retained = false; // True from mt_retain_frame() until mt_release_frame()
 
-// The buffer used for protobuf encoding/decoding. Since there's only one, and it's global, we
-// have to make sure we're only ever doing one encoding or decoding at a time.
-#define PB_BUFSIZE 512
-pb_byte_t pb_buf[PB_BUFSIZE+4];
-size_t pb_size = 0; // Number of bytes currently in the buffer
+// Ports the app has subscribed to with mt_subscribe_portnum(). Until it subscribes to any, it
+// gets packets on all of them.
+uint32_t subscribed_ports[(meshtastic_PortNum_MAX + 1) / 32];
+bool port_filter_on = false;
 
-// Nonce to request only my nodeinfo and skip other nodes in the db
-#define SPECIAL_NONCE 69420
+// want_config IDs the firmware treats specially: the first gets everything but the other nodes in
+// its DB, the second only the nodes. Any other ID gets everything.
+#define NONCE_ONLY_CONFIG 69420
+#define NONCE_ONLY_NODES 69421
 
-// Wait this many msec if there's nothing new on the channel
+// mt_loop() waits this many msec if there's nothing new on the channel. mt_poll() never waits.
 #define NO_NEWS_PAUSE 25
 
+// The longest mt_poll() will suggest waiting before calling it again, even if no timed work is due
+#define IDLE_POLL_MS 1000
+
+// While log lines are waiting for room on Serial, come back this soon to write more of them
+#define LOG_DRAIN_MS 10
+
+// Limits on how much work a single mt_loop() or mt_poll() call may do draining frames that have already
+// arrived. A time budget of 0 means only the frame budget applies.
+#define DRAIN_MAX_FRAMES 32
+#define DRAIN_MAX_MS 50
+uint16_t drain_max_frames = DRAIN_MAX_FRAMES;
+uint32_t drain_max_ms = DRAIN_MAX_MS;
+
 // Serial connections require at least one ping every 15 minutes
 // Otherwise the connection is closed, and packets will no longer be received
 // We will send a ping every 60 seconds, which is what the web client does
@@ -28,6 +120,15 @@ uint32_t last_heartbeat_at = 0;
 
 // The ID of the current WANT_CONFIG request
 uint32_t want_config_id = 0;
+mt_sync_mode_t sync_mode = MT_SYNC_FULL;  // What want_config_id asked for
+uint8_t sync_state = 0;
+
+meshtastic_Channel channels[MT_MAX_CHANNELS];
+uint8_t channels_seen = 0;  // Bit i is set once we have channels[i]
+
+// The one part of the radio's config we act on, kept for snapshots
+meshtastic_Config_LoRaConfig lora_config;
+bool have_lora_config = false;
 
 // Node number of the MT node hosting our WiFi
 uint32_t my_node_num = 0;
@@ -36,22 +137,46 @@ void (*text_message_callback)(uint32_t from, uint32_t to,  uint8_t channel, cons
 void (*portnum_callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload) = NULL;
 void (*encrypted_callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *enc_payload) = NULL;
 
+void (*packet_callback)(const mt_packet_meta_t * meta, mt_bytes_t payload) = NULL;
+void (*console_log_callback)(const char * text, size_t len) = NULL;
+
+// Unishox2, the firmware's own text compression, is the default codec when it's been vendored into
+// src/ by bin/fetch-unishox2.sh, which also builds it to take the size of its output buffer
+#if defined(__has_include)
+#if __has_include("unishox2.h")
+#define MT_UNISHOX2
+#endif
+#endif
+
+#ifdef MT_UNISHOX2
+extern "C" {
+#include "unishox2.h"
+}
+
+static size_t unishox2_text_compress(const char * text, size_t len, uint8_t * out, size_t out_size) {
+  int n = unishox2_compress(text, len, UNISHOX_API_OUT_AND_LEN((char *)out, out_size), USX_PSET_DFLT);
+  return n > 0 && (size_t)n <= out_size ? n : 0;
+}
+
+static size_t unishox2_text_decompress(const uint8_t * data, size_t len, char * out, size_t out_size) {
+  int n = unishox2_decompress((const char *)data, len, UNISHOX_API_OUT_AND_LEN(out, out_size), USX_PSET_DFLT);
+  return n > 0 && (size_t)n <= out_size ? n : 0;
+}
+
+size_t (*text_compress)(const char * text, size_t len, uint8_t * out, size_t out_size) = unishox2_text_compress;
+size_t (*text_decompress)(const uint8_t * data, size_t len, char * out, size_t out_size) = unishox2_text_decompress;
+#else
+// The text codec set with mt_set_text_codec(), if any
+size_t (*text_compress)(const char * text, size_t len, uint8_t * out, size_t out_size) = NULL;
+size_t (*text_decompress)(const uint8_t * data, size_t len, char * out, size_t out_size) = NULL;
+#endif
+
 void (*node_report_callback)(mt_node_t *, mt_nr_progress_t) = NULL;
 mt_node_t node;
 
 bool mt_wifi_mode = false;
 bool mt_serial_mode = false;
 
-#define VA_BUFSIZE 512
-void _d(const char * fmt, ...) {
-  static char vabuf[VA_BUFSIZE];
-  va_list ap;
-  va_start(ap, fmt);
-  vsnprintf(vabuf, sizeof(vabuf), fmt, ap);
-  Serial.println(vabuf);
-  Serial.flush();
-}
-
 bool mt_send_radio(const char * buf, size_t len) {
   if (mt_wifi_mode) {
     #ifdef MT_WIFI_SUPPORTED
@@ -67,67 +192,301 @@ bool mt_send_radio(const char * buf, size_t len) {
   }
 }
 
-bool _mt_send_toRadio(meshtastic_ToRadio toRadio) {
-  pb_buf[0] = MT_MAGIC_0;
-  pb_buf[1] = MT_MAGIC_1;
+#ifdef MT_STREAMING_ENCODE
+static bool tx_flush() {
+  bool ok = tx_chunk_len == 0 || mt_send_radio((const char *)tx_buf, tx_chunk_len);
+  tx_chunk_len = 0;
+  return ok;
+}
 
-  pb_ostream_t stream = pb_ostream_from_buffer(pb_buf + 4, PB_BUFSIZE);
-  bool status = pb_encode(&stream, meshtastic_ToRadio_fields, &toRadio);
-  if (!status) {
+static bool tx_stream_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count) {
+  while (count > 0) {
+    size_t n = TX_CHUNK_SIZE - tx_chunk_len;
+    if (n > count) n = count;
+    memcpy(tx_buf + tx_chunk_len, buf, n);
+    tx_chunk_len += n;
+    buf += n;
+    count -= n;
+    if (tx_chunk_len == TX_CHUNK_SIZE && !tx_flush()) return false;
+  }
+  return true;
+}
+
+bool mt_send_toRadio(const meshtastic_ToRadio * toRadio) {
+  size_t len;
+  if (!pb_get_encoded_size(&len, meshtastic_ToRadio_fields, toRadio) || len > PB_BUFSIZE) {
     d("Couldn't encode toRadio");
     return false;
   }
 
+  pb_byte_t header[MT_HEADER_SIZE] = {MT_MAGIC_0, MT_MAGIC_1, (pb_byte_t)(len / 256), (pb_byte_t)(len % 256)};
+  tx_chunk_len = 0;
+  pb_ostream_t stream = PB_OSTREAM_SIZING;
+  stream.callback = &tx_stream_write;
+  stream.max_size = len;
+  if (!tx_stream_write(&stream, header, MT_HEADER_SIZE)) return false;
+  bool status = pb_encode(&stream, meshtastic_ToRadio_fields, toRadio);
+  // Even if encoding failed part way, the header has promised len bytes, so the radio will take
+  // whatever follows as part of this frame. Nothing we can do about that but say so.
+  if (!status) d("Couldn't encode toRadio after sending its header");
+  return tx_flush() && status;
+}
+#else
+// Encode a ToRadio, with its header, into buf (which must have room for PB_BUFSIZE+4 bytes).
+// Returns the length of the frame, or 0 if it couldn't be encoded.
+size_t mt_encode_toRadio(pb_byte_t * buf, const meshtastic_ToRadio * toRadio) {
+  buf[0] = MT_MAGIC_0;
+  buf[1] = MT_MAGIC_1;
+
+  pb_ostream_t stream = pb_ostream_from_buffer(buf + 4, PB_BUFSIZE);
+  bool status = pb_encode(&stream, meshtastic_ToRadio_fields, toRadio);
+  if (!status) {
+    d("Couldn't encode toRadio");
+    return 0;
+  }
+
   // Store the payload length in the header
-  pb_buf[2] = stream.bytes_written / 256;
-  pb_buf[3] = stream.bytes_written % 256;
+  buf[2] = stream.bytes_written / 256;
+  buf[3] = stream.bytes_written % 256;
 
-  bool rv = mt_send_radio((const char *)pb_buf, 4 + stream.bytes_written);
+  return 4 + stream.bytes_written;
+}
 
-  // Clear the buffer so it can be used to hold reply packets
-  pb_size = 0;
+bool mt_send_toRadio(const meshtastic_ToRadio * toRadio) {
+  size_t len = mt_encode_toRadio(tx_buf, toRadio);
+  if (len == 0) return false;
+  return mt_send_radio((const char *)tx_buf, len);
+}
+#endif
 
-  return rv;
+// How many bytes value takes as a varint
+static size_t varint_size(size_t value) {
+  size_t n = 1;
+  while (value > 0x7F) {
+    value >>= 7;
+    n++;
+  }
+  return n;
 }
 
-// Request a node report from our MT
-bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t)) {
+// Encode a MeshPacket onto the free end of the TX queue's pool, and queue it. The frame is the
+// header, the tag and length of ToRadio's packet field, then the MeshPacket itself, which encode()
+// writes, so no ToRadio ever needs to be built. Like nanopb's back-patching of submessages, room is
+// left for the longest length the packet could have, and the packet moved down over what isn't
+// needed once its real length is known, so it's only walked once.
+static bool queue_packet(bool (*encode)(pb_ostream_t *, const void *), const void * arg, uint32_t id,
+                         uint32_t dest, bool want_ack, uint8_t priority) {
+  size_t room;
+  pb_byte_t *frame = mt_txq_reserve(&room, want_ack);
+  if (frame == NULL) return false;
+  bool whole = room >= MT_HEADER_SIZE + PB_BUFSIZE;  // Room for the largest frame there is
+  if (whole) room = MT_HEADER_SIZE + PB_BUFSIZE;
+
+  size_t reserved = varint_size(room);
+  if (room < MT_HEADER_SIZE + 1 + reserved) {
+    mt_txq_overflow();
+    return false;
+  }
+  pb_ostream_t stream = pb_ostream_from_buffer(frame + MT_HEADER_SIZE, room - MT_HEADER_SIZE);
+  pb_encode_tag(&stream, PB_WT_STRING, meshtastic_ToRadio_packet_tag);
+  pb_byte_t *start = frame + MT_HEADER_SIZE + stream.bytes_written;
+  pb_ostream_t packet = pb_ostream_from_buffer(start + reserved, stream.max_size - stream.bytes_written - reserved);
+  if (!encode(&packet, arg)) {
+    d("Couldn't encode MeshPacket: %s", PB_GET_ERROR(&packet));
+    // Most likely it just didn't fit in what's left of the pool
+    if (!whole) mt_txq_overflow();
+    return false;
+  }
+
+  size_t size = packet.bytes_written;
+  size_t width = varint_size(size);
+  if (width < reserved) memmove(start + width, start + reserved, size);
+  pb_encode_varint(&stream, size);
+  size_t payload_len = stream.bytes_written + size;
+  frame[0] = MT_MAGIC_0;
+  frame[1] = MT_MAGIC_1;
+  frame[2] = payload_len / 256;
+  frame[3] = payload_len % 256;
+
+  mt_txq_commit(frame, MT_HEADER_SIZE + payload_len, id, dest, want_ack, priority, millis());
+  return true;
+}
+
+// The priority a packet goes out with: its own, or else the one for its port
+static uint8_t packet_priority(const meshtastic_MeshPacket * packet) {
+  if (packet->priority != meshtastic_MeshPacket_Priority_UNSET) return packet->priority;
+  meshtastic_PortNum port = packet->which_payload_variant == meshtastic_MeshPacket_decoded_tag
+    ? packet->decoded.portnum : meshtastic_PortNum_UNKNOWN_APP;
+  return mt_txq_priority(port, packet->want_ack);
+}
+
+static bool encode_mesh_packet(pb_ostream_t * stream, const void * arg) {
+  const meshtastic_MeshPacket *packet = (const meshtastic_MeshPacket *)arg;
+  if (!pb_encode(stream, meshtastic_MeshPacket_fields, packet)) return false;
+  if (packet->priority != meshtastic_MeshPacket_Priority_UNSET) return true;
+  // The packet is the caller's, so rather than set its priority, tack the field on the end
+  return pb_encode_tag(stream, PB_WT_VARINT, meshtastic_MeshPacket_priority_tag)
+    && pb_encode_varint(stream, packet_priority(packet));
+}
+
+bool mt_send_packet(const meshtastic_MeshPacket * packet) {
+  return queue_packet(&encode_mesh_packet, packet, packet->id, packet->to, packet->want_ack, packet_priority(packet));
+}
+
+// The fields mt_send_data() puts in a MeshPacket, and in the Data inside it
+typedef struct {
+  uint32_t id;
+  uint32_t dest;
+  uint8_t channel;
+  bool want_ack;
+  uint8_t priority;
+  meshtastic_PortNum port;
+  mt_bytes_t payload;
+} mt_data_packet_t;
+
+// The Data's encoded length, worked out rather than sized with a stream. Its tags take a byte each.
+static size_t data_size(const mt_data_packet_t * p) {
+  size_t size = 0;
+  if (p->port != 0) size += 1 + varint_size(p->port);
+  if (p->payload.len != 0) size += 1 + varint_size(p->payload.len) + p->payload.len;
+  return size;
+}
+
+// Like pb_encode(), leave out fields that are zero or empty
+static bool encode_data(pb_ostream_t * stream, const mt_data_packet_t * p) {
+  if (p->port != 0) {
+    if (!pb_encode_tag(stream, PB_WT_VARINT, 1) || !pb_encode_varint(stream, p->port)) return false;
+  }
+  if (p->payload.len != 0) {
+    if (!pb_encode_tag(stream, PB_WT_STRING, 2)) return false;
+    if (!pb_encode_string(stream, p->payload.data, p->payload.len)) return false;
+  }
+  return true;
+}
+
+// A MeshPacket with these fields set, in field order and leaving out those that are zero, as
+// pb_encode() does
+static bool encode_data_packet(pb_ostream_t * stream, const void * arg) {
+  const mt_data_packet_t *p = (const mt_data_packet_t *)arg;
+  if (p->dest != 0) {
+    if (!pb_encode_tag(stream, PB_WT_32BIT, 2) || !pb_encode_fixed32(stream, &p->dest)) return false;
+  }
+  if (p->channel != 0) {
+    if (!pb_encode_tag(stream, PB_WT_VARINT, 3) || !pb_encode_varint(stream, p->channel)) return false;
+  }
+  if (!pb_encode_tag(stream, PB_WT_STRING, 4) || !pb_encode_varint(stream, data_size(p))) return false;
+  if (!encode_data(stream, p)) return false;
+  if (p->id != 0) {
+    if (!pb_encode_tag(stream, PB_WT_32BIT, 6) || !pb_encode_fixed32(stream, &p->id)) return false;
+  }
+  if (p->want_ack) {
+    if (!pb_encode_tag(stream, PB_WT_VARINT, 10) || !pb_encode_varint(stream, 1)) return false;
+  }
+  if (p->priority != 0) {
+    if (!pb_encode_tag(stream, PB_WT_VARINT, 11) || !pb_encode_varint(stream, p->priority)) return false;
+  }
+  return true;
+}
+
+bool mt_send_data(meshtastic_PortNum port, mt_bytes_t payload, uint32_t dest, uint8_t channel_index, bool want_ack, uint32_t * packet_id) {
+  if (payload.len > sizeof(((meshtastic_Data_payload_t *)0)->bytes)) {
+    d("Payload of %u bytes won't fit in a packet", (unsigned)payload.len);
+    return false;
+  }
+
+  mt_data_packet_t p;
+  p.id = random(0x7FFFFFFF);
+  p.dest = dest;
+  p.channel = channel_index;
+  p.want_ack = want_ack;
+  p.priority = mt_txq_priority(port, want_ack);
+  p.port = port;
+  p.payload = payload;
+
+  if (!queue_packet(&encode_data_packet, &p, p.id, dest, want_ack, p.priority)) return false;
+  if (packet_id != NULL) *packet_id = p.id;
+  return true;
+}
+
+// Ask our MT to send its config (and, depending on the ID, its node DB) followed by the ID back
+bool send_want_config(uint32_t id) {
   meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
   toRadio.which_payload_variant = meshtastic_ToRadio_want_config_id_tag;
-  want_config_id = random(0x7FffFFff);  // random() can't handle anything bigger
-  toRadio.want_config_id = want_config_id;
+  toRadio.want_config_id = id;
+  return mt_send_toRadio(&toRadio);
+}
 
-#ifdef MT_DEBUGGING
-  Serial.print("Requesting node report with random ID ");
-  Serial.println(want_config_id);
-#endif
+static bool start_sync(mt_sync_mode_t mode) {
+  uint32_t id;
+  switch (mode) {
+    case MT_SYNC_CONFIG:
+    case MT_SYNC_STAGED:
+      id = NONCE_ONLY_CONFIG;
+      break;
+    case MT_SYNC_NODES:
+      id = NONCE_ONLY_NODES;
+      break;
+    default:
+      id = random(0x7FffFFff);  // random() can't handle anything bigger
+      break;
+  }
+
+  d("Requesting sync mode %d with ID %lu", mode, (unsigned long)id);
 
-  bool rv = _mt_send_toRadio(toRadio);
+  if (!send_want_config(id)) return false;
+  want_config_id = id;
+  sync_mode = mode;
+  return true;
+}
 
+bool mt_request_sync(mt_sync_mode_t mode, void (*callback)(mt_node_t *, mt_nr_progress_t)) {
+  bool rv = start_sync(mode);
   if (rv) node_report_callback = callback;
   return rv;
 }
 
-bool mt_send_text(const char * text, uint32_t dest, uint8_t channel_index) {
-  meshtastic_MeshPacket meshPacket = meshtastic_MeshPacket_init_default;
-  meshPacket.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
-  meshPacket.id = random(0x7FFFFFFF);
-  meshPacket.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
-  meshPacket.to = dest;
-  meshPacket.channel = channel_index;
-  meshPacket.want_ack = true;
-  meshPacket.decoded.payload.size = strlen(text);
-  memcpy(meshPacket.decoded.payload.bytes, text, meshPacket.decoded.payload.size);
+// Request a node report from our MT
+bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t)) {
+  return mt_request_sync(MT_SYNC_FULL, callback);
+}
 
-  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
-  toRadio.which_payload_variant = meshtastic_ToRadio_packet_tag;
-  toRadio.packet = meshPacket;
-  
-  Serial.print("Sending text message '");
-  Serial.print(text);
-  Serial.print("' to ");
-  Serial.println(dest);
-  return _mt_send_toRadio(toRadio);
+uint8_t mt_sync_state() {
+  return sync_state;
+}
+
+bool mt_get_channel(uint8_t index, meshtastic_Channel * channel) {
+  if (index >= MT_MAX_CHANNELS || !(channels_seen & (1 << index))) return false;
+  *channel = channels[index];
+  return true;
+}
+
+void mt_set_text_codec(size_t (*compress)(const char * text, size_t len, uint8_t * out, size_t out_size),
+                       size_t (*decompress)(const uint8_t * data, size_t len, char * out, size_t out_size)) {
+  text_compress = compress;
+  text_decompress = decompress;
+}
+
+bool mt_send_text(const char * text, uint32_t dest, uint8_t channel_index) {
+  meshtastic_PortNum port = meshtastic_PortNum_TEXT_MESSAGE_APP;
+  mt_bytes_t payload;
+  payload.data = (const uint8_t *)text;
+  payload.len = strlen(text);
+
+  mt_log("Sending text message '%s' to %lu", text, (unsigned long)dest);
+
+  // Send whichever of the plain and compressed text is shorter. Text that wouldn't fit in a packet
+  // uncompressed isn't compressed either, as it couldn't be decompressed into one at the other end.
+  uint8_t compressed[meshtastic_Constants_DATA_PAYLOAD_LEN];
+  if (text_compress != NULL && payload.len <= meshtastic_Constants_DATA_PAYLOAD_LEN) {
+    size_t len = text_compress(text, payload.len, compressed, sizeof(compressed));
+    if (len > 0 && len < payload.len) {
+      d("Compressed text from %u to %u bytes", (unsigned)payload.len, (unsigned)len);
+      port = meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP;
+      payload.data = compressed;
+      payload.len = len;
+    }
+  }
+  return mt_send_data(port, payload, dest, channel_index, true);
 }
 
 bool mt_send_heartbeat() {
@@ -138,7 +497,7 @@ bool mt_send_heartbeat() {
   toRadio.which_payload_variant = meshtastic_ToRadio_heartbeat_tag;
   toRadio.heartbeat = meshtastic_Heartbeat_init_default;
 
-  return _mt_send_toRadio(toRadio);
+  return mt_send_toRadio(&toRadio);
 
 }
 
@@ -154,10 +513,51 @@ void set_text_message_callback(void (*callback)(uint32_t from, uint32_t to,  uin
   text_message_callback = callback;
 }
 
-bool handle_id_tag(uint32_t id) {
-  d("id_tag: ID: %d\r\n", id);
+void set_packet_callback(void (*callback)(const mt_packet_meta_t * meta, mt_bytes_t payload)) {
+  packet_callback = callback;
+}
+
+#if MT_DECODE_TARGET == MT_DECODE_ARENA
+bool mt_set_decode_arena(void * arena, size_t len) {
+  if (len < MT_DECODE_ARENA_SIZE) return false;
+  rx_frame = (meshtastic_FromRadio *)arena;
   return true;
 }
+#endif
+
+bool mt_retain_frame() {
+  if (!rx_frame_in_callback) return false;
+  rx_frame_retained = true;
+  return true;
+}
+
+void mt_release_frame() {
+  rx_frame_retained = false;
+}
+
+void set_console_log_callback(void (*callback)(const char * text, size_t len)) {
+  console_log_callback = callback;
+}
+
+void mt_get_rx_stats(mt_rx_stats_t * stats) {
+  *stats = rx_stats;
+}
+
+void mt_subscribe_portnum(meshtastic_PortNum port, bool subscribe) {
+  if ((unsigned)port > meshtastic_PortNum_MAX) return;
+  if (subscribe) {
+    subscribed_ports[port / 32] |= 1UL << (port % 32);
+  } else {
+    subscribed_ports[port / 32] &= ~(1UL << (port % 32));
+  }
+  port_filter_on = true;
+}
+
+bool port_subscribed(meshtastic_PortNum port) {
+  if (!port_filter_on) return true;
+  if ((unsigned)port > meshtastic_PortNum_MAX) return false;
+  return subscribed_ports[port / 32] & (1UL << (port % 32));
+}
 
 bool handle_config_tag(meshtastic_Config *config) {
   switch (config->which_payload_variant) {
@@ -230,6 +630,9 @@ bool handle_config_tag(meshtastic_Config *config) {
       break;
 
     case meshtastic_Config_lora_tag:
+      lora_config = config->payload_variant.lora;
+      have_lora_config = true;
+      mt_airtime_set_lora(&lora_config);
       d("Config:lora_tag:use_preset: %d  \r\n", config->payload_variant.lora.use_preset);
       d("Config:lora_tag:modem_preset: %d  \r\n", config->payload_variant.lora.modem_preset);
       d("Config:lora_tag:bandwidth: %d  \r\n", config->payload_variant.lora.bandwidth);
@@ -295,6 +698,11 @@ bool handle_channel_tag(meshtastic_Channel *channel) {
   d("ChannelTag:index: %d\r\n", channel->index);
   d("ChannelTag:has_settings: %d\r\n", channel->has_settings);
   d("ChannelTag:role: %d\r\n", channel->role);
+  if (channel->index < 0 || channel->index >= MT_MAX_CHANNELS) return false;
+  channels[channel->index] = *channel;
+  channels_seen |= 1 << channel->index;
+  // The radio sends every slot, disabled or not
+  if (channels_seen == (1 << MT_MAX_CHANNELS) - 1) sync_state |= MT_HAVE_CHANNELS;
   return true;
 }
 
@@ -451,11 +859,12 @@ bool handle_moduleConfig_tag(meshtastic_ModuleConfig *module){
   return true;
 }
 
-bool handle_queueStatus_tag(meshtastic_QueueStatus *qstatus) {
+bool handle_queueStatus_tag(uint32_t now, meshtastic_QueueStatus *qstatus) {
   d("queueStatus: maxlen: %d\r\n", qstatus->maxlen);
   d("queueStatus: res: %d\r\n", qstatus->res);
   d("queueStatus: free: %d\r\n", qstatus->free);
   d("queueStatus: mesh_packet_id: %d\r\n", qstatus->mesh_packet_id);
+  mt_txq_handle_status(now, qstatus);
   return true;
 }
 
@@ -503,53 +912,50 @@ bool handle_fileInfo_tag(meshtastic_FileInfo *fInfo) {
 
 bool handle_my_info(meshtastic_MyNodeInfo *myNodeInfo) {
   my_node_num = myNodeInfo->my_node_num;
+  sync_state |= MT_HAVE_MY_INFO;
   return true;
 }
 
-bool handle_node_info(meshtastic_NodeInfo *nodeInfo) {
-  if (node_report_callback == NULL) {
-    d("Got a node report, but we don't have a callback");
-    return false;
+// A node's record as the radio sent it, in the form the app sees it in. Each device metric is
+// only taken if it's there; a missing one is left NAN (or 0, for the battery level).
+void node_from_info(const meshtastic_NodeInfo * info, mt_node_t * node) {
+  memset(node, 0, sizeof(*node));
+  node->node_num = info->num;
+  node->is_mine = info->num == my_node_num;
+  node->last_heard_from = info->last_heard;
+  node->has_user = info->has_user;
+  if (node->has_user) {
+    memcpy(node->user_id, info->user.id, MAX_USER_ID_LEN);
+    memcpy(node->long_name, info->user.long_name, MAX_LONG_NAME_LEN);
+    memcpy(node->short_name, info->user.short_name, MAX_SHORT_NAME_LEN);
   }
-  node.node_num = nodeInfo->num;
-  node.is_mine = nodeInfo->num == my_node_num;
-  node.last_heard_from = nodeInfo->last_heard;
-  node.has_user = nodeInfo->has_user;
-  if (node.has_user) {
-    memcpy(node.user_id, nodeInfo->user.id, MAX_USER_ID_LEN);
-    memcpy(node.long_name, nodeInfo->user.long_name, MAX_LONG_NAME_LEN);
-    memcpy(node.short_name, nodeInfo->user.short_name, MAX_SHORT_NAME_LEN);
-  }
-
-  if (nodeInfo->has_position) {
-    node.latitude = nodeInfo->position.latitude_i / 1e7;
-    node.longitude = nodeInfo->position.longitude_i / 1e7;
-    node.altitude = nodeInfo->position.altitude;
-    node.ground_speed = nodeInfo->position.ground_speed;
-    node.last_heard_position = nodeInfo->position.time;
-    node.time_of_last_position = nodeInfo->position.timestamp;
-  } else {
-    node.latitude = NAN;
-    node.longitude = NAN;
-    node.altitude = 0;
-    node.ground_speed = 0;
-    node.battery_level = 0;
-    node.last_heard_position = 0;
-    node.time_of_last_position = 0;
-  }
-  if (nodeInfo->has_device_metrics) {
-    node.battery_level = nodeInfo->device_metrics.battery_level;
-    node.voltage = nodeInfo->device_metrics.voltage;
-    node.channel_utilization = nodeInfo->device_metrics.channel_utilization;
-    node.air_util_tx = nodeInfo->device_metrics.air_util_tx;
+
+  if (info->has_position) {
+    node->latitude = info->position.latitude_i / 1e7;
+    node->longitude = info->position.longitude_i / 1e7;
+    node->altitude = info->position.altitude;
+    node->ground_speed = info->position.ground_speed;
+    node->last_heard_position = info->position.time;
+    node->time_of_last_position = info->position.timestamp;
   } else {
-    node.battery_level = 0;
-    node.voltage = NAN;
-    node.channel_utilization = NAN; 
-    node.air_util_tx = NAN;
+    node->latitude = NAN;
+    node->longitude = NAN;
   }
+  const meshtastic_DeviceMetrics *m = &info->device_metrics;
+  bool metrics = info->has_device_metrics;
+  if (metrics && m->has_battery_level) node->battery_level = m->battery_level;
+  node->voltage = metrics && m->has_voltage ? m->voltage : NAN;
+  node->channel_utilization = metrics && m->has_channel_utilization ? m->channel_utilization : NAN;
+  node->air_util_tx = metrics && m->has_air_util_tx ? m->air_util_tx : NAN;
+  node->snr = info->snr;
+}
 
-  node_report_callback(&node, MT_NR_IN_PROGRESS);
+bool handle_node_info(meshtastic_NodeInfo *nodeInfo) {
+  mt_airtime_handle_node_info(nodeInfo);
+  node_from_info(nodeInfo, &node);
+  mt_nodedb_put(&node);
+
+  if (node_report_callback != NULL) node_report_callback(&node, MT_NR_IN_PROGRESS);
   return true;
 }
 
@@ -559,23 +965,99 @@ bool handle_config_complete_id(uint32_t now, uint32_t config_complete_id) {
     mt_wifi_reset_idle_timeout(now);  // It's fine if we're actually in serial mode
     #endif
     want_config_id = 0;
-    node_report_callback(NULL, MT_NR_DONE);
+    if (sync_mode != MT_SYNC_NODES) sync_state |= MT_HAVE_MY_INFO | MT_HAVE_CHANNELS | MT_HAVE_CONFIG;
+    if (sync_mode != MT_SYNC_CONFIG && sync_mode != MT_SYNC_STAGED) sync_state |= MT_HAVE_NODES;
+
+    // If we can't ask for the nodes now, the app can still ask for them itself
+    if (sync_mode == MT_SYNC_STAGED && start_sync(MT_SYNC_NODES)) return true;
+
+    if (node_report_callback != NULL) node_report_callback(NULL, MT_NR_DONE);
     node_report_callback = NULL;
-  } else {
+  } else if (node_report_callback != NULL) {
     node_report_callback(NULL, MT_NR_INVALID);  // but return true, since it was still a valid packet
   }
   return true;
 }
 
+// Hand a packet to the packet callback as a view of its payload plus its metadata, without copying
+void deliver_mesh_packet(meshtastic_MeshPacket *meshPacket) {
+  mt_packet_meta_t meta;
+  meta.id = meshPacket->id;
+  meta.from = meshPacket->from;
+  meta.to = meshPacket->to;
+  meta.channel = meshPacket->channel;
+  meta.rx_time = meshPacket->rx_time;
+  meta.rx_snr = meshPacket->rx_snr;
+  meta.rx_rssi = meshPacket->rx_rssi;
+  meta.hop_limit = meshPacket->hop_limit;
+  meta.hop_start = meshPacket->hop_start;
+  meta.want_ack = meshPacket->want_ack;
+  meta.via_mqtt = meshPacket->via_mqtt;
+
+  mt_bytes_t payload;
+  if (meshPacket->which_payload_variant == meshtastic_MeshPacket_decoded_tag) {
+    meta.encrypted = false;
+    meta.portnum = meshPacket->decoded.portnum;
+    meta.request_id = meshPacket->decoded.request_id;
+    payload.data = meshPacket->decoded.payload.bytes;
+    payload.len = meshPacket->decoded.payload.size;
+  } else {
+    meta.encrypted = true;
+    meta.portnum = meshtastic_PortNum_UNKNOWN_APP;
+    meta.request_id = 0;
+    payload.data = meshPacket->encrypted.bytes;
+    payload.len = meshPacket->encrypted.size;
+  }
+  packet_callback(&meta, payload);
+}
+
+// The text callback expects a NUL-terminated string, which the payload only has room for if it's
+// shorter than the largest possible one.
+void deliver_text_message(meshtastic_MeshPacket *meshPacket) {
+  meshtastic_Data_payload_t *payload = &meshPacket->decoded.payload;
+  if (payload->size < sizeof(payload->bytes)) {
+    payload->bytes[payload->size] = 0;
+    text_message_callback(meshPacket->from, meshPacket->to, meshPacket->channel, (const char*)payload->bytes);
+  } else {
+    char text[sizeof(payload->bytes) + 1];
+    memcpy(text, payload->bytes, sizeof(payload->bytes));
+    text[sizeof(payload->bytes)] = 0;
+    text_message_callback(meshPacket->from, meshPacket->to, meshPacket->channel, text);
+  }
+}
+
+// Decompress text from the compressed text port, and hand it to the text callback. The firmware
+// won't decompress more than a payload's worth of text, so neither do we.
+void deliver_compressed_text(meshtastic_MeshPacket *meshPacket) {
+  char text[meshtastic_Constants_DATA_PAYLOAD_LEN + 1];
+  meshtastic_Data_payload_t *payload = &meshPacket->decoded.payload;
+  size_t len = text_decompress(payload->bytes, payload->size, text, sizeof(text) - 1);
+  if (len == 0 && payload->size > 0) {
+    d("Couldn't decompress a %d byte text message", payload->size);
+    return;
+  }
+  text[len] = 0;
+  text_message_callback(meshPacket->from, meshPacket->to, meshPacket->channel, text);
+}
+
 bool handle_mesh_packet(meshtastic_MeshPacket *meshPacket) {
+  if (packet_callback != NULL) deliver_mesh_packet(meshPacket);
+
   if (meshPacket->which_payload_variant == meshtastic_MeshPacket_decoded_tag) {
     switch (meshPacket->decoded.portnum) {
         case meshtastic_PortNum_TEXT_MESSAGE_APP:
             if (text_message_callback != NULL) {
-              text_message_callback(meshPacket->from, meshPacket->to, meshPacket->channel, (const char*)meshPacket->decoded.payload.bytes);
+              deliver_text_message(meshPacket);
           } else {
         }
         break;
+      case meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP:
+        if (text_decompress != NULL && text_message_callback != NULL) {
+          deliver_compressed_text(meshPacket);
+        } else if (portnum_callback != NULL) {
+          portnum_callback(meshPacket->from, meshPacket->to, meshPacket->channel, meshPacket->decoded.portnum, &meshPacket->decoded.payload);
+        }
+        break;
       case meshtastic_PortNum_ADMIN_APP:
       case meshtastic_PortNum_ATAK_FORWARDER:
       case meshtastic_PortNum_ATAK_PLUGIN:
@@ -598,7 +1080,6 @@ bool handle_mesh_packet(meshtastic_MeshPacket *meshPacket) {
       case meshtastic_PortNum_SIMULATOR_APP:
       case meshtastic_PortNum_STORE_FORWARD_APP:
       case meshtastic_PortNum_TELEMETRY_APP: 
-      case meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP:
       case meshtastic_PortNum_TRACEROUTE_APP: 
       case meshtastic_PortNum_UNKNOWN_APP: 
       case meshtastic_PortNum_WAYPOINT_APP: 
@@ -622,150 +1103,610 @@ bool handle_mesh_packet(meshtastic_MeshPacket *meshPacket) {
   return true;
 }
 
+// Return the byte at offset i from the read cursor of the ring
+static inline pb_byte_t rx_peek(size_t i) {
+  i += rx_head;
+  if (i >= RX_BUFSIZE) i -= RX_BUFSIZE;
+  return rx_buf[i];
+}
+
+// Consume n bytes from the front of the ring
+static void rx_consume(size_t n) {
+  rx_head += n;
+  if (rx_head >= RX_BUFSIZE) rx_head -= RX_BUFSIZE;
+  rx_size -= n;
+}
+
+// pb_istream_t callback that reads straight out of the ring, wrapping around its end as needed.
+// The stream state is the ring index of the next byte to read.
+static bool rx_stream_read(pb_istream_t *stream, pb_byte_t *buf, size_t count) {
+  size_t pos = (size_t)stream->state;
+  size_t chunk = RX_BUFSIZE - pos;
+  if (chunk > count) chunk = count;
+  memcpy(buf, rx_buf + pos, chunk);
+  memcpy(buf + chunk, rx_buf, count - chunk);
+  pos += count;
+  if (pos >= RX_BUFSIZE) pos -= RX_BUFSIZE;
+  stream->state = (void *)pos;
+  return true;
+}
+
+// Offset from the read cursor of the first byte that could start a frame, or rx_size if there's none.
+// The ring's contents are at most two contiguous regions, so this is at most two memchr() calls.
+static size_t rx_find_magic() {
+  size_t first = RX_BUFSIZE - rx_head;
+  if (first > rx_size) first = rx_size;
+  const pb_byte_t *p = (const pb_byte_t *)memchr(rx_buf + rx_head, MT_MAGIC_0, first);
+  if (p != NULL) return p - (rx_buf + rx_head);
+  p = (const pb_byte_t *)memchr(rx_buf, MT_MAGIC_0, rx_size - first);
+  if (p != NULL) return first + (p - rx_buf);
+  return rx_size;
+}
+
+// Could this byte be part of the radio's plain-text debug console output?
+static inline bool is_console_char(pb_byte_t c) {
+  return (c >= 0x20 && c < 0x7f) || c == '\r' || c == '\n' || c == '\t' || c == 0x1b;
+}
+
+// Drop the first n bytes of the ring, which aren't part of any frame. Runs of text among them are
+// most likely the radio's debug console, so they're passed to the console log callback as they lie
+// in the ring.
+static void rx_discard(size_t n) {
+  rx_stats.bytes_discarded += n;
+  if (console_log_callback != NULL) {
+    size_t start = 0, len = 0;
+    for (size_t i = 0; i < n; i++) {
+      size_t pos = rx_head + i;
+      if (pos >= RX_BUFSIZE) pos -= RX_BUFSIZE;
+      if (len > 0 && (pos == 0 || !is_console_char(rx_buf[pos]))) {
+        console_log_callback((const char *)rx_buf + start, len);
+        rx_stats.console_bytes += len;
+        len = 0;
+      }
+      if (is_console_char(rx_buf[pos])) {
+        if (len == 0) start = pos;
+        len++;
+      }
+    }
+    if (len > 0) {
+      console_log_callback((const char *)rx_buf + start, len);
+      rx_stats.console_bytes += len;
+    }
+  }
+  rx_consume(n);
+}
+
+// Return a stream over the next len bytes of the ring, starting at offset from the read cursor
+static pb_istream_t rx_istream(size_t offset, size_t len) {
+  size_t pos = rx_head + offset;
+  if (pos >= RX_BUFSIZE) pos -= RX_BUFSIZE;
+
+  // Most frames don't straddle the end of the ring, and a plain buffer stream is cheaper
+  if (pos + len <= RX_BUFSIZE) return pb_istream_from_buffer(rx_buf + pos, len);
+
+  pb_istream_t stream;
+  stream.callback = &rx_stream_read;
+  stream.state = (void *)pos;
+  stream.bytes_left = len;
+#ifndef PB_NO_ERRMSG
+  stream.errmsg = NULL;
+#endif
+  return stream;
+}
+
+#ifdef MT_STREAMING_DECODE
+// Read straight from the connection, waiting for bytes that haven't arrived yet
+size_t mt_protocol_read_direct(pb_byte_t *buf, size_t len) {
+  if (mt_wifi_mode) {
+#ifdef MT_WIFI_SUPPORTED
+    return mt_wifi_read_radio((char *)buf, len, STREAM_TIMEOUT_MS);
+#endif
+  } else if (mt_serial_mode) {
+    return mt_serial_read_radio((char *)buf, len, STREAM_TIMEOUT_MS);
+  }
+  return 0;
+}
+
+// pb_istream_t callback for a frame that's only partly in the ring: what's already there is read
+// first, then the rest is pulled from the connection as the decoder consumes it.
+static bool rx_stream_read_through(pb_istream_t *stream, pb_byte_t *buf, size_t count) {
+  size_t buffered = count < rx_size ? count : rx_size;
+  if (buffered > 0) {
+    pb_istream_t ring = rx_istream(0, buffered);
+    pb_read(&ring, buf, buffered);
+    rx_consume(buffered);
+    buf += buffered;
+    count -= buffered;
+  }
+  if (count == 0) return true;
+  if (mt_protocol_read_direct(buf, count) == count) return true;
+  d("Timed out waiting for the rest of a packet");
+  return false;
+}
+#endif
+
+#ifdef MT_PEEK_FILTER
+// What we can learn about a frame by walking its top-level tags, without decoding it
+typedef struct {
+  pb_size_t variant;  // The FromRadio payload variant's tag, or 0 if it has none
+  // The rest is only filled in for packets
+  uint32_t from;
+  uint32_t to;
+  uint32_t channel;
+  bool encrypted;
+  meshtastic_PortNum portnum;
+  uint32_t rx_time;
+  float rx_snr;
+} mt_peek_t;
+
+// Find the portnum of a Data message, skipping everything else
+static bool peek_data(pb_istream_t *stream, mt_peek_t *peek) {
+  pb_wire_type_t wire_type;
+  uint32_t tag, value;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_Data_portnum_tag && wire_type == PB_WT_VARINT) {
+      if (!pb_decode_varint32(stream, &value)) return false;
+      peek->portnum = (meshtastic_PortNum)value;
+    } else if (!pb_skip_field(stream, wire_type)) {
+      return false;
+    }
+  }
+  return eof;
+}
+
+// Pick out the addressing, reception and portnum of a MeshPacket, skipping everything else
+static bool peek_mesh_packet(pb_istream_t *stream, mt_peek_t *peek) {
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    bool ok;
+    if (tag == meshtastic_MeshPacket_from_tag && wire_type == PB_WT_32BIT) {
+      ok = pb_decode_fixed32(stream, &peek->from);
+    } else if (tag == meshtastic_MeshPacket_to_tag && wire_type == PB_WT_32BIT) {
+      ok = pb_decode_fixed32(stream, &peek->to);
+    } else if (tag == meshtastic_MeshPacket_channel_tag && wire_type == PB_WT_VARINT) {
+      ok = pb_decode_varint32(stream, &peek->channel);
+    } else if (tag == meshtastic_MeshPacket_rx_time_tag && wire_type == PB_WT_32BIT) {
+      ok = pb_decode_fixed32(stream, &peek->rx_time);
+    } else if (tag == meshtastic_MeshPacket_rx_snr_tag && wire_type == PB_WT_32BIT) {
+      ok = pb_decode_fixed32(stream, &peek->rx_snr);
+    } else if (tag == meshtastic_MeshPacket_decoded_tag && wire_type == PB_WT_STRING) {
+      pb_istream_t data;
+      peek->encrypted = false;
+      ok = pb_make_string_substream(stream, &data) && peek_data(&data, peek) && pb_close_string_substream(stream, &data);
+    } else {
+      if (tag == meshtastic_MeshPacket_encrypted_tag) peek->encrypted = true;
+      ok = pb_skip_field(stream, wire_type);
+    }
+    if (!ok) return false;
+  }
+  return eof;
+}
+
+// Walk the top-level tags of a FromRadio to see which variant it holds, and for packets, who it's
+// from and to and which port it's on. The stream is taken by value, so the caller's copy is still
+// at the start of the frame afterwards. Returns false if the frame is malformed.
+static bool peek_frame(pb_istream_t stream, mt_peek_t *peek) {
+  memset(peek, 0, sizeof(*peek));
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    bool ok;
+    if (tag == meshtastic_FromRadio_packet_tag && wire_type == PB_WT_STRING) {
+      pb_istream_t packet;
+      peek->variant = tag;
+      ok = pb_make_string_substream(&stream, &packet) && peek_mesh_packet(&packet, peek) && pb_close_string_substream(&stream, &packet);
+    } else {
+      if (tag != meshtastic_FromRadio_id_tag) peek->variant = tag;
+      ok = pb_skip_field(&stream, wire_type);
+    }
+    if (!ok) return false;
+  }
+  return eof;
+}
+
+// Would anything act on this frame if we decoded it?
+static bool frame_wanted(const mt_peek_t *peek) {
+#ifdef MT_DEBUGGING
+  return true;  // It's going to be printed, if nothing else, and that's what debugging is for
+#endif
+  switch (peek->variant) {
+    case meshtastic_FromRadio_packet_tag:
+      if (peek->portnum == meshtastic_PortNum_ROUTING_APP && mt_txq_awaiting_ack()) return true;
+      if (mt_chunk_wanted(peek->portnum)) return true;
+      // Our own node's telemetry has our channel utilization in it
+      if (peek->portnum == meshtastic_PortNum_TELEMETRY_APP && peek->from == my_node_num) return true;
+      // Nodes' names, positions and metrics go in the node table
+      if (!peek->encrypted && mt_nodedb_wanted(peek->portnum)) return true;
+      if (!port_subscribed(peek->portnum)) return false;
+      if (packet_callback != NULL) return true;
+      if (peek->encrypted) return encrypted_callback != NULL;
+      if (peek->portnum == meshtastic_PortNum_TEXT_MESSAGE_APP) return text_message_callback != NULL;
+      if (peek->portnum == meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP && text_decompress != NULL) {
+        return text_message_callback != NULL || portnum_callback != NULL;
+      }
+      return portnum_callback != NULL;
+    case meshtastic_FromRadio_my_info_tag:
+    case meshtastic_FromRadio_config_complete_id_tag:
+    case meshtastic_FromRadio_rebooted_tag:
+    case meshtastic_FromRadio_queueStatus_tag:
+    case meshtastic_FromRadio_config_tag:  // For the LoRa settings
+    case meshtastic_FromRadio_channel_tag:
+      return true;
+    case meshtastic_FromRadio_node_info_tag:
+      // Unless the app asked for a node report, the only NodeInfo the radio sends is our own,
+      // which has our channel utilization in it
+      return true;
+    default:
+      return false;
+  }
+}
+#endif
+
+#if MT_DECODE_TARGET == MT_DECODE_VARIANT
+// The message type of each payload variant we decode, or NULL for those we skip
+static const pb_msgdesc_t * variant_fields(uint32_t tag) {
+  switch (tag) {
+    case meshtastic_FromRadio_packet_tag: return meshtastic_MeshPacket_fields;
+    case meshtastic_FromRadio_my_info_tag: return meshtastic_MyNodeInfo_fields;
+    case meshtastic_FromRadio_node_info_tag: return meshtastic_NodeInfo_fields;
+    case meshtastic_FromRadio_queueStatus_tag: return meshtastic_QueueStatus_fields;
+    case meshtastic_FromRadio_config_tag: return meshtastic_Config_fields;
+    case meshtastic_FromRadio_channel_tag: return meshtastic_Channel_fields;
+#ifdef MT_DEBUGGING
+    case meshtastic_FromRadio_log_record_tag: return meshtastic_LogRecord_fields;
+    case meshtastic_FromRadio_moduleConfig_tag: return meshtastic_ModuleConfig_fields;
+    case meshtastic_FromRadio_xmodemPacket_tag: return meshtastic_XModem_fields;
+    case meshtastic_FromRadio_metadata_tag: return meshtastic_DeviceMetadata_fields;
+    case meshtastic_FromRadio_mqttClientProxyMessage_tag: return meshtastic_MqttClientProxyMessage_fields;
+    case meshtastic_FromRadio_fileInfo_tag: return meshtastic_FileInfo_fields;
+#endif
+    default: return NULL;
+  }
+}
+#endif
+
+// Decode a frame into wherever MT_DECODE_TARGET says. Sets *variant to the FromRadio payload variant
+// it holds and *msg to that variant's message, or to NULL if it's a variant we don't decode.
+bool decode_frame(pb_istream_t *stream, pb_size_t *variant, void **msg) {
+#if MT_DECODE_TARGET == MT_DECODE_VARIANT
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  *variant = 0;
+  *msg = NULL;
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    const pb_msgdesc_t *fields = variant_fields(tag);
+    bool ok;
+    if (fields != NULL && wire_type == PB_WT_STRING) {
+      pb_istream_t substream;
+      ok = pb_make_string_substream(stream, &substream) && pb_decode(&substream, fields, &rx_frame) &&
+           pb_close_string_substream(stream, &substream);
+      *msg = &rx_frame;
+    } else if ((tag == meshtastic_FromRadio_config_complete_id_tag || tag == meshtastic_FromRadio_rebooted_tag) &&
+               wire_type == PB_WT_VARINT) {
+      uint32_t value;
+      ok = pb_decode_varint32(stream, &value);
+      if (tag == meshtastic_FromRadio_rebooted_tag) {
+        rx_frame.rebooted = value != 0;
+      } else {
+        rx_frame.config_complete_id = value;
+      }
+      *msg = &rx_frame;
+    } else {
+      ok = pb_skip_field(stream, wire_type);
+      if (tag != meshtastic_FromRadio_id_tag) *msg = NULL;
+    }
+    if (!ok) return false;
+    if (tag != meshtastic_FromRadio_id_tag) *variant = tag;
+  }
+  return eof;
+#else
+#if MT_DECODE_TARGET == MT_DECODE_ARENA
+  meshtastic_FromRadio *fromRadio = rx_frame;
+#else
+  meshtastic_FromRadio *fromRadio = &rx_frame;
+#endif
+  if (!pb_decode(stream, meshtastic_FromRadio_fields, fromRadio)) return false;
+  *variant = fromRadio->which_payload_variant;
+  *msg = &fromRadio->packet;  // All the variants share the same storage
+  return true;
+#endif
+}
+
 // Parse a packet that came in, and handle it. Return true if we were able to parse it.
 bool handle_packet(uint32_t now, size_t payload_len) {
-  meshtastic_FromRadio fromRadio = meshtastic_FromRadio_init_zero;
-
-  // Decode the protobuf and shift forward any remaining bytes in the buffer (which, if
-  // present, belong to the packet that we're going to process on the next loop)
-  pb_istream_t stream = pb_istream_from_buffer(pb_buf + 4, payload_len);
-  bool status = pb_decode(&stream, meshtastic_FromRadio_fields, &fromRadio);
-  memmove(pb_buf, pb_buf+4+payload_len, PB_BUFSIZE-4-payload_len);
-  pb_size -= 4 + payload_len;
+  bool status;
+  pb_size_t variant;
+  void *msg;
+#ifdef MT_STREAMING_DECODE
+  if (MT_HEADER_SIZE + payload_len > rx_size) {
+    // Decode as the bytes arrive. Whatever the decoder didn't read (because it failed, or gave up
+    // waiting) is dropped as it comes in, so we pick up again at the next frame.
+    rx_consume(MT_HEADER_SIZE);
+    pb_istream_t stream;
+    stream.callback = &rx_stream_read_through;
+    stream.state = NULL;
+    stream.bytes_left = payload_len;
+#ifndef PB_NO_ERRMSG
+    stream.errmsg = NULL;
+#endif
+    status = decode_frame(&stream, &variant, &msg);
+    rx_skip_left = stream.bytes_left;
+  } else
+#endif
+  {
+    pb_istream_t stream = rx_istream(MT_HEADER_SIZE, payload_len);
+
+#ifdef MT_PEEK_FILTER
+    // Don't bother decoding frames nobody is interested in. Every frame that is wanted gets walked
+    // twice, though, so this only pays when most of them aren't (see MT_PEEK_FILTER in
+    // Meshtastic.h).
+    mt_peek_t peek;
+    if (peek_frame(stream, &peek) && !frame_wanted(&peek)) {
+      // Even so, it tells us when we last heard from its sender
+      if (peek.variant == meshtastic_FromRadio_packet_tag) mt_nodedb_heard(peek.from, peek.rx_time, peek.rx_snr);
+      rx_stats.frames_filtered++;
+      rx_consume(MT_HEADER_SIZE + payload_len);
+      return true;
+    }
+#endif
 
-  // Be prepared to request a node report to re-establish flow after an MT reboot
-  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
-  toRadio.which_payload_variant = meshtastic_ToRadio_want_config_id_tag;
-  toRadio.want_config_id = SPECIAL_NONCE;
+    // Decode the protobuf in place, then release its bytes from the ring
+    status = decode_frame(&stream, &variant, &msg);
+    rx_consume(MT_HEADER_SIZE + payload_len);
+  }
 
   if (!status) {
     d("Decoding failed");
+    rx_stats.decode_errors++;
     return false;
   }
 
-  switch (fromRadio.which_payload_variant) {
-    case meshtastic_FromRadio_id_tag: // 1
-      return handle_id_tag(fromRadio.id);
-    case meshtastic_FromRadio_packet_tag: //2
-      return handle_mesh_packet(&fromRadio.packet);
+  if (msg == NULL) {
+    // A variant nothing acts on, so we didn't decode it
+    rx_stats.frames_filtered++;
+    return true;
+  }
+
+  switch (variant) {
+    case meshtastic_FromRadio_packet_tag: { //2
+      meshtastic_MeshPacket *meshPacket = (meshtastic_MeshPacket *)msg;
+      mt_txq_handle_packet(now, meshPacket);
+      mt_airtime_handle_packet(meshPacket);
+      mt_nodedb_handle_packet(meshPacket);
+      if (mt_chunk_handle_packet(now, meshPacket)) return true;
+      // Packets let through only for the library's own use (routing replies, our own telemetry)
+      // stop here if the app didn't subscribe to them
+      if (meshPacket->which_payload_variant == meshtastic_MeshPacket_decoded_tag
+          && !port_subscribed(meshPacket->decoded.portnum)) return true;
+      return handle_mesh_packet(meshPacket);
+    }
     case meshtastic_FromRadio_my_info_tag: // 3
-      return handle_my_info(&fromRadio.my_info);
+      return handle_my_info((meshtastic_MyNodeInfo *)msg);
     case meshtastic_FromRadio_node_info_tag: // 4
-      return handle_node_info(&fromRadio.node_info);
+      return handle_node_info((meshtastic_NodeInfo *)msg);
     case meshtastic_FromRadio_config_tag : // 5
-      return handle_config_tag(&fromRadio.config);
+      return handle_config_tag((meshtastic_Config *)msg);
     case meshtastic_FromRadio_log_record_tag: // 6
-      return handle_FromRadio_log_record_tag(&fromRadio.log_record);
+      return handle_FromRadio_log_record_tag((meshtastic_LogRecord *)msg);
     case meshtastic_FromRadio_config_complete_id_tag: // 7
-      return handle_config_complete_id(now, fromRadio.config_complete_id);
+      return handle_config_complete_id(now, *(uint32_t *)msg);
     case meshtastic_FromRadio_rebooted_tag: // 8
-      _mt_send_toRadio(toRadio);
-
+      // Whatever we were asking for, we'll have to ask again. Otherwise just get the config, to
+      // re-establish flow after an MT reboot.
+      sync_state = 0;
+      channels_seen = 0;
+      return start_sync(want_config_id != 0 ? sync_mode : MT_SYNC_CONFIG);
     case  meshtastic_FromRadio_moduleConfig_tag: // 9
-      return handle_moduleConfig_tag(&fromRadio.moduleConfig);
+      return handle_moduleConfig_tag((meshtastic_ModuleConfig *)msg);
     case meshtastic_FromRadio_channel_tag: // 10
-      return handle_channel_tag(&fromRadio.channel);
+      return handle_channel_tag((meshtastic_Channel *)msg);
     case meshtastic_FromRadio_queueStatus_tag: // 11
-      return handle_queueStatus_tag(&fromRadio.queueStatus); 
+      return handle_queueStatus_tag(now, (meshtastic_QueueStatus *)msg);
     case  meshtastic_FromRadio_xmodemPacket_tag: // 12
-      return handle_xmodemPacket_tag(&fromRadio.xmodemPacket);
+      return handle_xmodemPacket_tag((meshtastic_XModem *)msg);
     case meshtastic_FromRadio_metadata_tag: //        13
-      return handle_metatag_data(&fromRadio.metadata);
+      return handle_metatag_data((meshtastic_DeviceMetadata *)msg);
     case meshtastic_FromRadio_mqttClientProxyMessage_tag: // 14
-      return handle_mqttClientProxyMessage_tag(&fromRadio.mqttClientProxyMessage);
+      return handle_mqttClientProxyMessage_tag((meshtastic_MqttClientProxyMessage *)msg);
     case meshtastic_FromRadio_fileInfo_tag :  // 15
-      return handle_fileInfo_tag(&fromRadio.fileInfo); 
+      return handle_fileInfo_tag((meshtastic_FileInfo *)msg);
 
     default:
-#ifdef MT_DEBUGGING
-        // Rate limit
-        // Serial input buffer overflows during initial connection, while we're slowly printing these at 9600 baud
-        constexpr uint32_t limitMs = 100; 
-        static uint32_t lastLog = 0;
-        uint32_t now = millis();
-        if (now - lastLog > limitMs) {
-            lastLog = now;
-            Serial.print("Got a payloadVariant we don't recognize: ");
-            Serial.println(fromRadio.which_payload_variant);
-        }
-#endif
+      // The log drops these rather than holding us up if a burst of them arrives on connection
+      d("Got a payloadVariant we don't recognize: %u", (unsigned)variant);
       return false;
   }
-
-  d("Handled a packet");
 }
 
-void mt_protocol_check_packet(uint32_t now) {
-  if (pb_size < MT_HEADER_SIZE) {
-    // We don't even have a header yet
-    delay(NO_NEWS_PAUSE);
-    return;
-  }
+// Handle the frame at the front of the ring, if it's complete. Returns true if a frame was consumed.
+//
+// Anything in front of the next plausible header (magic number plus a sane length) is dropped, so
+// that line noise or console output can't make us lose the frames behind it.
+bool mt_protocol_check_packet(uint32_t now) {
+  // The app is still using the last frame we decoded, so leave new ones in the ring for now
+  if (rx_frame_retained) return false;
+
+#if MT_DECODE_TARGET == MT_DECODE_ARENA
+  // Nowhere to decode to yet
+  if (rx_frame == NULL) return false;
+#endif
 
-  if (pb_buf[0] != MT_MAGIC_0 || pb_buf[1] != MT_MAGIC_1) {
-    d("Got bad magic");
-    memset(pb_buf, 0, PB_BUFSIZE);
-    pb_size = 0;
-    return;
-  }
+  uint16_t payload_len;
+  while (true) {
+    if (rx_skip_left > 0) {
+      // Still working our way past a frame we have no room for
+      size_t n = rx_skip_left < rx_size ? rx_skip_left : rx_size;
+      rx_stats.bytes_discarded += n;
+      rx_consume(n);
+      rx_skip_left -= n;
+      if (rx_skip_left > 0) return false;
+    }
 
-  uint16_t payload_len = pb_buf[2] << 8 | pb_buf[3];
-  if (payload_len > PB_BUFSIZE) {
-    d("Got packet claiming to be ridiculous length");
-    return;
-  }
+    size_t magic = rx_find_magic();
+    if (magic > 0) rx_discard(magic);
 
-  if ((size_t)(payload_len + 4) > pb_size) {
-    // d("Partial packet");
-    delay(NO_NEWS_PAUSE);
-    return;
+    if (rx_size >= 2 && rx_peek(1) != MT_MAGIC_1) {
+      d("Got bad magic");
+      rx_discard(1);
+      continue;
+    }
+
+    if (rx_size < MT_HEADER_SIZE) {
+      // We don't even have a header yet
+      return false;
+    }
+
+    payload_len = rx_peek(2) << 8 | rx_peek(3);
+    if (payload_len > MT_MAX_PAYLOAD) {
+      d("Got packet claiming to be ridiculous length");
+      rx_discard(1);
+      continue;
+    }
+
+#ifndef MT_STREAMING_DECODE
+    if ((size_t)(payload_len + MT_HEADER_SIZE) > RX_BUFSIZE) {
+      d("Skipping a %d byte packet that won't fit in the buffer", payload_len);
+      rx_stats.frames_oversized++;
+      rx_skip_left = payload_len + MT_HEADER_SIZE;
+      continue;
+    }
+
+    if ((size_t)(payload_len + MT_HEADER_SIZE) > rx_size) {
+      // d("Partial packet");
+      return false;
+    }
+#endif
+    break;
   }
 
   /*
 #ifdef MT_DEBUGGING
     Serial.print("Got a full packet! ");
-    for (int i = 0 ; i < pb_size ; i++) {
-      Serial.print(pb_buf[i], HEX);
+    for (int i = 0 ; i < rx_size ; i++) {
+      Serial.print(rx_peek(i), HEX);
       Serial.print(" ");
     }
     Serial.println();
 #endif
   */
 
+  rx_frame_in_callback = true;
   handle_packet(now, payload_len);
+  rx_frame_in_callback = false;
+  return true;
 }
 
-bool mt_loop(uint32_t now) {
-  bool rv;
+// Read whatever the radio has sent into the free space of the ring. The free space can be split
+// in two by the end of the ring, so the transport may be asked to fill up to two regions.
+size_t mt_protocol_read_radio(size_t (*check_radio)(char *, size_t)) {
   size_t bytes_read = 0;
+  for (int region = 0; region < 2 && rx_size < RX_BUFSIZE; region++) {
+    size_t tail = rx_head + rx_size;
+    if (tail >= RX_BUFSIZE) tail -= RX_BUFSIZE;
+    size_t space = (tail >= rx_head ? RX_BUFSIZE : rx_head) - tail;
+    if (space > RX_BUFSIZE - rx_size) space = RX_BUFSIZE - rx_size;
+
+    size_t got = check_radio((char *)rx_buf + tail, space);
+    rx_size += got;
+    bytes_read += got;
+    if (got < space) break;
+  }
+  return bytes_read;
+}
+
+// Top up the ring from whichever transport we're connected through
+void mt_protocol_fill() {
+  if (mt_wifi_mode) {
+#ifdef MT_WIFI_SUPPORTED
+    mt_protocol_read_radio(mt_wifi_check_radio);
+#endif
+  } else if (mt_serial_mode) {
+    mt_protocol_read_radio(mt_serial_check_radio);
+  }
+}
+
+void mt_set_drain_budget(uint16_t max_frames, uint32_t max_ms) {
+  drain_max_frames = max_frames > 0 ? max_frames : 1;
+  drain_max_ms = max_ms;
+}
+
+// Pull *next_due in to at, if at comes sooner. Times are compared by their signed distance so
+// that this keeps working when millis() wraps around.
+void mt_due_at(uint32_t * next_due, uint32_t at) {
+  if ((int32_t)(at - *next_due) < 0) *next_due = at;
+}
+
+bool mt_poll(uint32_t now, uint32_t * next_due, uint16_t * frames_handled) {
+  bool rv = false;
+  uint32_t due = now + IDLE_POLL_MS;
 
-  // See if there are any more bytes to add to our buffer.
-  size_t space_left = PB_BUFSIZE - pb_size;
- 
   if (mt_wifi_mode) {
 #ifdef MT_WIFI_SUPPORTED
     rv = mt_wifi_loop(now);
-    if (rv) bytes_read = mt_wifi_check_radio((char *)pb_buf + pb_size, space_left);
-#else
-    return false;
+    mt_due_at(&due, mt_wifi_next_deadline());
 #endif
   } else if (mt_serial_mode) {
 
     rv = mt_serial_loop();
-    if (rv) bytes_read = mt_serial_check_radio((char *)pb_buf + pb_size, space_left);
 
     // if heartbeat interval has passed, send a heartbeat to keep serial connection alive
     if(now >= (last_heartbeat_at + HEARTBEAT_INTERVAL_MS)){
         mt_send_heartbeat();
         last_heartbeat_at = now;
     }
+    mt_due_at(&due, last_heartbeat_at + HEARTBEAT_INTERVAL_MS);
 
   } else {
-    Serial.println("mt_loop() called but it was never initialized");
+    Serial.println("mt_poll() called but it was never initialized");
     while(1);
   }
 
-  pb_size += bytes_read;
-  mt_protocol_check_packet(now); 
+  // Write out whatever the radio has room for
+  mt_log_drain();
+  if (rv) {
+    mt_chunk_service(now);
+    mt_txq_service(now);
+  }
+
+  // Handle every complete frame we have, topping up the ring from the radio between frames,
+  // until we run out or hit the drain budget.
+  uint16_t frames = 0;
+  uint32_t started = millis();
+  while (true) {
+    if (rv) mt_protocol_fill();
+    if (!mt_protocol_check_packet(now)) break;
+    if (++frames >= drain_max_frames || (drain_max_ms > 0 && millis() - started >= drain_max_ms)) {
+      // We stopped early, so there may well be more waiting already
+      due = now;
+      break;
+    }
+  }
+
+  // Only now, as the frames just handled (a QueueStatus, say, or a send from a callback) can have
+  // changed what's due
+  if (mt_log_pending()) mt_due_at(&due, now + LOG_DRAIN_MS);
+  if (rv) {
+    mt_chunk_deadline(&due);
+    mt_txq_deadline(&due);
+  }
+
+  if (next_due != NULL) *next_due = due;
+  if (frames_handled != NULL) *frames_handled = frames;
+  return rv;
+}
+
+bool mt_loop(uint32_t now, uint16_t * frames_handled) {
+  uint16_t frames;
+  bool rv = mt_poll(now, NULL, &frames);
+
+  // Older sketches call us from a tight loop(), so give the radio a moment to send more
+  if (frames == 0) delay(NO_NEWS_PAUSE);
+
+  if (frames_handled != NULL) *frames_handled = frames;
   return rv;
 }
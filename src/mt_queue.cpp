@@ -0,0 +1,555 @@
+#include "mt_internals.h"
+
+// Outgoing MeshPackets wait in this queue until the radio has room for them. After taking each
+// packet, the radio sends a QueueStatus saying how many free slots its own TX queue has left and
+// whether it accepted the packet; anything written beyond that is silently dropped by the firmware.
+// So we only write while the last report said there's room, and keep each packet until the radio
+// has accepted it, putting it back on the queue if it was turned away.
+//
+// Packets are written highest priority first (the MeshPacket priority, which is also what the
+// radio goes by), and oldest first among equals. The longer a packet waits, the more its priority
+// is bumped up, as far as the next level above its own, so a steady stream of DEFAULT packets
+// can't hold BACKGROUND ones back forever. Nothing is ever aged up to HIGH, though: a fresh alert
+// still goes ahead of everything that's merely been waiting.
+//
+// If the app has set a delivery callback, packets sent with want_ack are also tracked in a small
+// table of their own until the mesh answers with a Routing ACK or NAK, or until they time out.
+// Their slot is freed as soon as the radio takes them, like any other packet's, unless they may
+// need resending (see mt_set_delivery_policy()), in which case the frame is kept until they're
+// answered.
+//
+// The frames themselves are kept at their encoded length, one after another in a shared pool, so
+// that a queue of short texts doesn't cost a full-sized buffer per packet. When a frame is done
+// with, the ones behind it are moved down over it.
+
+// How many packets can be waiting at once. The firmware's own TX queue holds 16, so a bigger board
+// that sends in bursts can define it that big, at about 28 bytes a packet.
+#ifndef MT_TX_QUEUE_LEN
+#define MT_TX_QUEUE_LEN 8
+#endif
+
+// Bytes set aside for the frames of waiting packets, which must be room for at least the largest.
+// The default holds the largest frame, or eight or so typical texts; a board with RAM to spare can
+// define it bigger for longer bursts.
+#ifndef MT_TX_POOL_SIZE
+#define MT_TX_POOL_SIZE 640
+#endif
+#if MT_TX_POOL_SIZE < PB_BUFSIZE + MT_HEADER_SIZE
+#error "MT_TX_POOL_SIZE must be at least PB_BUFSIZE + 4"
+#endif
+
+// If the radio hasn't said what became of a packet within this long, assume it was accepted.
+// Older firmware never sends QueueStatus at all.
+#define QUEUE_STATUS_TIMEOUT_MS 2000
+
+// The size of the radio's TX queue, until it tells us otherwise
+#define RADIO_QUEUE_LEN 16
+
+// Give up on a packet once the radio has turned it away this many times
+#define MAX_TX_ATTEMPTS 3
+
+// A waiting packet's priority goes up by one for every this many msec it's been queued, so it
+// takes a BACKGROUND packet 54 seconds to catch up with a newly queued DEFAULT one, and a DEFAULT
+// one 6 seconds to catch up with RELIABLE
+#define PRIORITY_AGING_MS 1000
+
+// While the airtime governor is holding packets back, check again this often whether they can go
+#define HOLD_RECHECK_MS 5000
+
+// How many ports can have their priority set with mt_set_port_priority()
+#define PORT_PRIORITIES 4
+
+// How many packets can be waiting on an ACK at once. Beyond that, packets sent with want_ack are
+// refused while there's a delivery callback to report on them.
+#ifndef MT_ACK_WAIT_LEN
+#define MT_ACK_WAIT_LEN 4
+#endif
+
+// How many destinations we keep delivery stats for. When a new one turns up, the one we've
+// sent to least recently makes way for it.
+#ifndef MT_LINK_STATS_LEN
+#define MT_LINK_STATS_LEN 4
+#endif
+
+typedef enum {
+  TX_FREE,
+  TX_QUEUED,  // Waiting to be written
+  TX_SENT,    // Written, and waiting for the radio to say whether it took it
+  TX_KEPT     // Taken by the radio, and kept in case it isn't ACKed and has to be resent
+} mt_tx_state_t;
+
+typedef struct {
+  mt_tx_state_t state;
+  uint8_t attempts;  // Writes the radio has turned away
+  bool held;         // Whether the airtime governor has ever held it back
+  uint8_t priority;
+  int8_t ack;        // Its entry in ack_waits, or -1 if it isn't tracked
+  uint32_t packet_id;
+  uint32_t seq;      // Order the packets were queued in
+  uint32_t queued_at;
+  uint32_t sent_at;
+  uint16_t offset;   // Where its frame starts in tx_pool
+  uint16_t len;
+} mt_tx_slot_t;
+
+mt_tx_slot_t tx_slots[MT_TX_QUEUE_LEN];
+uint32_t tx_seq = 0;
+
+typedef enum {
+  ACK_FREE,
+  ACK_QUEUED,  // Not yet taken by the radio
+  ACK_WAITING  // Taken by the radio, and waiting for the mesh to ACK or NAK it
+} mt_ack_state_t;
+
+typedef struct {
+  mt_ack_state_t state;
+  uint8_t resends_left;  // Times we'll still resend it if it isn't ACKed
+  int8_t slot;           // Its TX slot, or -1 once that's been freed
+  uint32_t packet_id;
+  uint32_t dest;
+  uint32_t sent_at;      // When it was last written to the radio
+} mt_ack_wait_t;
+
+mt_ack_wait_t ack_waits[MT_ACK_WAIT_LEN];
+
+pb_byte_t tx_pool[MT_TX_POOL_SIZE];
+size_t tx_pool_used = 0;
+
+// How many more packets the radio can take, according to its last QueueStatus. Until we hear
+// otherwise, assume its queue is empty, and let its first reply tell us the real number.
+uint16_t radio_free = RADIO_QUEUE_LEN;
+uint32_t last_status_at = 0;
+
+// Set once a packet has gone unanswered without the radio ever having sent a QueueStatus, as older
+// firmware doesn't. Packets are then taken to be accepted as soon as they're written, rather than
+// each one waiting out QUEUE_STATUS_TIMEOUT_MS, until a QueueStatus turns up after all.
+bool status_heard = false;
+bool radio_silent = false;
+
+// When the queue was last serviced, if the airtime governor held anything back then
+bool tx_holding = false;
+uint32_t tx_held_at = 0;
+
+mt_tx_stats_t tx_stats;
+
+struct {
+  meshtastic_PortNum port;
+  uint8_t priority;  // UNSET if the entry is free
+} port_priorities[PORT_PRIORITIES];
+
+void mt_set_port_priority(meshtastic_PortNum port, meshtastic_MeshPacket_Priority priority) {
+  int free_entry = -1;
+  for (int i = 0; i < PORT_PRIORITIES; i++) {
+    if (port_priorities[i].priority != meshtastic_MeshPacket_Priority_UNSET && port_priorities[i].port == port) {
+      port_priorities[i].priority = priority;
+      return;
+    }
+    if (port_priorities[i].priority == meshtastic_MeshPacket_Priority_UNSET && free_entry < 0) free_entry = i;
+  }
+  if (free_entry < 0 || priority == meshtastic_MeshPacket_Priority_UNSET) return;
+  port_priorities[free_entry].port = port;
+  port_priorities[free_entry].priority = priority;
+}
+
+// The priority a packet on this port gets unless it says otherwise: whatever the app set for the
+// port, or else what the firmware would give it
+uint8_t mt_txq_priority(meshtastic_PortNum port, bool want_ack) {
+  for (int i = 0; i < PORT_PRIORITIES; i++) {
+    if (port_priorities[i].priority != meshtastic_MeshPacket_Priority_UNSET && port_priorities[i].port == port) {
+      return port_priorities[i].priority;
+    }
+  }
+  switch (port) {
+    case meshtastic_PortNum_DETECTION_SENSOR_APP:
+      return meshtastic_MeshPacket_Priority_HIGH;
+    case meshtastic_PortNum_ROUTING_APP:
+      return meshtastic_MeshPacket_Priority_ACK;
+    case meshtastic_PortNum_POSITION_APP:
+    case meshtastic_PortNum_NODEINFO_APP:
+    case meshtastic_PortNum_TELEMETRY_APP:
+    case meshtastic_PortNum_NEIGHBORINFO_APP:
+    case meshtastic_PortNum_MAP_REPORT_APP:
+      return want_ack ? meshtastic_MeshPacket_Priority_RELIABLE : meshtastic_MeshPacket_Priority_BACKGROUND;
+    default:
+      return want_ack ? meshtastic_MeshPacket_Priority_RELIABLE : meshtastic_MeshPacket_Priority_DEFAULT;
+  }
+}
+
+void (*delivery_callback)(uint32_t packet_id, uint32_t dest, mt_delivery_t result, meshtastic_Routing_Error error, uint32_t rtt_ms) = NULL;
+uint32_t ack_timeout_ms = 60000;
+uint8_t max_resends = 0;
+
+mt_link_stats_t link_stats[MT_LINK_STATS_LEN];
+uint32_t link_used_at[MT_LINK_STATS_LEN];
+
+void set_delivery_callback(void (*callback)(uint32_t packet_id, uint32_t dest, mt_delivery_t result, meshtastic_Routing_Error error, uint32_t rtt_ms)) {
+  delivery_callback = callback;
+}
+
+void mt_set_delivery_policy(uint32_t timeout_ms, uint8_t resends) {
+  ack_timeout_ms = timeout_ms;
+  max_resends = resends;
+}
+
+// Find the stats for a destination, making room for them if asked to: in an empty entry if there
+// is one, or else in place of the one we sent to least recently
+static mt_link_stats_t * find_link(uint32_t node, bool create, uint32_t now) {
+  int empty = -1, oldest = -1;
+  for (int i = 0; i < MT_LINK_STATS_LEN; i++) {
+    mt_link_stats_t *link = &link_stats[i];
+    if (link->sent == 0) {
+      if (empty < 0) empty = i;
+      continue;
+    }
+    if (link->node == node) {
+      if (create) link_used_at[i] = now;
+      return link;
+    }
+    if (oldest < 0 || (int32_t)(link_used_at[i] - link_used_at[oldest]) < 0) oldest = i;
+  }
+  if (!create) return NULL;
+  if (empty >= 0) oldest = empty;
+  mt_link_stats_t *link = &link_stats[oldest];
+  memset(link, 0, sizeof(*link));
+  link->node = node;
+  link_used_at[oldest] = now;
+  return link;
+}
+
+bool mt_get_link_stats(uint32_t node, mt_link_stats_t * stats) {
+  mt_link_stats_t *link = find_link(node, false, 0);
+  if (link == NULL) return false;
+  *stats = *link;
+  return true;
+}
+
+// Bucket i of the RTT histogram counts round trips shorter than 128 << i ms (the last takes the rest)
+static uint8_t rtt_bucket(uint32_t rtt_ms) {
+  uint8_t i = 0;
+  rtt_ms >>= 7;
+  while (rtt_ms > 0 && i < MT_RTT_BUCKETS - 1) {
+    rtt_ms >>= 1;
+    i++;
+  }
+  return i;
+}
+
+// Free a slot, and move the frames behind its own down to close the gap
+static void release(mt_tx_slot_t * slot) {
+  size_t end = slot->offset + slot->len;
+  memmove(tx_pool + slot->offset, tx_pool + end, tx_pool_used - end);
+  tx_pool_used -= slot->len;
+  for (int i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    if (tx_slots[i].state != TX_FREE && tx_slots[i].offset > slot->offset) tx_slots[i].offset -= slot->len;
+  }
+  if (slot->ack >= 0) ack_waits[slot->ack].slot = -1;
+  slot->state = TX_FREE;
+}
+
+// Report what became of a tracked packet, and forget it
+static void finish(mt_ack_wait_t * ack, uint32_t now, mt_delivery_t result, meshtastic_Routing_Error error) {
+  uint32_t rtt = now - ack->sent_at;
+  mt_link_stats_t *link = find_link(ack->dest, false, now);
+  if (link != NULL) {
+    if (result == MT_DELIVERY_ACKED || result == MT_DELIVERY_RELAYED) {
+      link->acked++;
+      link->rtt_hist[rtt_bucket(rtt)]++;
+    } else {
+      link->failed++;
+    }
+  }
+  if (ack->slot >= 0) release(&tx_slots[ack->slot]);
+  ack->state = ACK_FREE;
+  if (delivery_callback != NULL) delivery_callback(ack->packet_id, ack->dest, result, error, rtt);
+}
+
+// Put a tracked packet that wasn't ACKed back on the queue, if it has resends left
+static bool resend(mt_ack_wait_t * ack) {
+  if (ack->resends_left == 0 || ack->slot < 0) return false;
+  d("Resending packet %u", ack->packet_id);
+  mt_tx_slot_t *slot = &tx_slots[ack->slot];
+  ack->resends_left--;
+  ack->state = ACK_QUEUED;
+  slot->attempts = 0;
+  slot->state = TX_QUEUED;
+  tx_stats.resent++;
+  return true;
+}
+
+// The radio has taken a packet. Its slot is done with, unless the packet is tracked and might have
+// to be resent.
+static void accepted(mt_tx_slot_t * slot) {
+  tx_stats.accepted++;
+  if (slot->ack < 0) {
+    release(slot);
+    return;
+  }
+  mt_ack_wait_t *ack = &ack_waits[slot->ack];
+  ack->state = ACK_WAITING;
+  if (ack->resends_left > 0) {
+    slot->state = TX_KEPT;
+  } else {
+    release(slot);
+  }
+}
+
+static mt_ack_wait_t * free_ack_wait() {
+  for (int i = 0; i < MT_ACK_WAIT_LEN; i++) {
+    if (ack_waits[i].state == ACK_FREE) return &ack_waits[i];
+  }
+  return NULL;
+}
+
+// How many bytes of frame could be queued right now, or 0 if every slot is taken
+size_t mt_txq_space() {
+  for (int i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    if (tx_slots[i].state == TX_FREE) return MT_TX_POOL_SIZE - tx_pool_used;
+  }
+  return 0;
+}
+
+// Return the free end of the pool to encode a frame into, setting *room to its size, or NULL if the
+// queue is full (or the packet's to be tracked, and too many are already waiting on ACKs)
+pb_byte_t * mt_txq_reserve(size_t * room, bool want_ack) {
+  *room = mt_txq_space();
+  if (*room == 0 || (want_ack && delivery_callback != NULL && free_ack_wait() == NULL)) {
+    mt_txq_overflow();
+    return NULL;
+  }
+  return tx_pool + tx_pool_used;
+}
+
+// The frame didn't fit in the room mt_txq_reserve() gave
+void mt_txq_overflow() {
+  d("TX queue full, dropping packet");
+  tx_stats.dropped++;
+}
+
+// Queue the frame that's been encoded into the room from mt_txq_reserve()
+void mt_txq_commit(pb_byte_t * frame, size_t len, uint32_t packet_id, uint32_t dest, bool want_ack,
+                   uint8_t priority, uint32_t now) {
+  for (int i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    mt_tx_slot_t *slot = &tx_slots[i];
+    if (slot->state != TX_FREE) continue;
+    slot->state = TX_QUEUED;
+    slot->attempts = 0;
+    slot->held = false;
+    slot->ack = -1;
+    slot->packet_id = packet_id;
+    mt_ack_wait_t *ack = want_ack && delivery_callback != NULL ? free_ack_wait() : NULL;
+    if (ack != NULL) {
+      ack->state = ACK_QUEUED;
+      ack->resends_left = max_resends;
+      ack->slot = i;
+      ack->packet_id = packet_id;
+      ack->dest = dest;
+      ack->sent_at = now;
+      slot->ack = ack - ack_waits;
+      find_link(dest, true, now)->sent++;
+    }
+    slot->priority = priority;
+    slot->seq = tx_seq++;
+    slot->queued_at = now;
+    slot->offset = frame - tx_pool;
+    slot->len = len;
+    tx_pool_used += len;
+    tx_stats.queued++;
+    mt_txq_service(now);
+    return;
+  }
+}
+
+// The levels a packet can be aged up to: each is as far as one below it can go, and HIGH (less
+// one) is as far as any can
+static const uint8_t aging_levels[] = {
+  meshtastic_MeshPacket_Priority_BACKGROUND, meshtastic_MeshPacket_Priority_DEFAULT,
+  meshtastic_MeshPacket_Priority_RELIABLE, meshtastic_MeshPacket_Priority_RESPONSE,
+  meshtastic_MeshPacket_Priority_HIGH - 1,
+};
+
+static uint32_t aged_priority(const mt_tx_slot_t * slot, uint32_t now) {
+  for (size_t i = 0; i < sizeof(aging_levels); i++) {
+    if (aging_levels[i] <= slot->priority) continue;
+    uint32_t aged = slot->priority + (now - slot->queued_at) / PRIORITY_AGING_MS;
+    return aged < aging_levels[i] ? aged : aging_levels[i];
+  }
+  return slot->priority;
+}
+
+// The queued packet to write next. Packets the airtime governor says must wait are passed over,
+// unless it's only being asked whether anything's queued at all.
+static mt_tx_slot_t * next_queued(uint32_t now, bool governed) {
+  mt_tx_slot_t *next = NULL;
+  uint32_t next_priority = 0;
+  for (int i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    mt_tx_slot_t *slot = &tx_slots[i];
+    if (slot->state != TX_QUEUED) continue;
+    if (governed && !mt_airtime_clear(slot->priority, slot->len - MT_HEADER_SIZE, slot->queued_at, now)) {
+      if (!slot->held) mt_airtime_count_held();
+      slot->held = true;
+      tx_holding = true;
+      tx_held_at = now;
+      continue;
+    }
+    uint32_t priority = aged_priority(slot, now);
+    if (next == NULL || priority > next_priority
+        || (priority == next_priority && (int32_t)(slot->seq - next->seq) < 0)) {
+      next = slot;
+      next_priority = priority;
+    }
+  }
+  return next;
+}
+
+// Write queued packets, oldest first, for as long as the radio has room
+void mt_txq_service(uint32_t now) {
+  for (int i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    mt_tx_slot_t *slot = &tx_slots[i];
+    if (slot->state == TX_SENT && now - slot->sent_at >= QUEUE_STATUS_TIMEOUT_MS) {
+      d("No QueueStatus for packet %u, assuming the radio took it", slot->packet_id);
+      if (!status_heard) radio_silent = true;
+      accepted(slot);
+      if (radio_free < RADIO_QUEUE_LEN) radio_free++;
+    }
+  }
+  for (int i = 0; i < MT_ACK_WAIT_LEN; i++) {
+    mt_ack_wait_t *ack = &ack_waits[i];
+    if (ack->state == ACK_WAITING && now - ack->sent_at >= ack_timeout_ms) {
+      d("No ACK for packet %u", ack->packet_id);
+      if (!resend(ack)) finish(ack, now, MT_DELIVERY_TIMED_OUT, meshtastic_Routing_Error_TIMEOUT);
+    }
+  }
+
+  // The radio said it was full, and hasn't told us since that it has room again. Rather than wait
+  // forever on a report that may never come, try one packet and let its reply set us straight.
+  if (radio_free == 0 && now - last_status_at >= QUEUE_STATUS_TIMEOUT_MS) radio_free = 1;
+
+  tx_holding = false;
+  while (radio_free > 0) {
+    mt_tx_slot_t *slot = next_queued(now, true);
+    if (slot == NULL) break;
+    if (!mt_send_radio((const char *)tx_pool + slot->offset, slot->len)) break;  // Try again next time
+    mt_airtime_sent(slot->len - MT_HEADER_SIZE);
+    slot->state = TX_SENT;
+    slot->sent_at = now;
+    slot->attempts++;
+    if (slot->ack >= 0) ack_waits[slot->ack].sent_at = now;
+    tx_stats.written++;
+    if (radio_silent) {
+      accepted(slot);
+    } else {
+      radio_free--;
+    }
+  }
+}
+
+void mt_txq_handle_status(uint32_t now, const meshtastic_QueueStatus * status) {
+  radio_free = status->free;
+  last_status_at = now;
+  status_heard = true;
+  radio_silent = false;
+
+  for (int i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    mt_tx_slot_t *slot = &tx_slots[i];
+    if (slot->state != TX_SENT || slot->packet_id != status->mesh_packet_id) continue;
+    if (status->res == 0) {
+      accepted(slot);
+    } else if (slot->attempts >= MAX_TX_ATTEMPTS) {
+      d("Radio refused packet %u %d times, giving up", slot->packet_id, slot->attempts);
+      tx_stats.rejected++;
+      if (slot->ack >= 0) {
+        finish(&ack_waits[slot->ack], now, MT_DELIVERY_REJECTED, meshtastic_Routing_Error_NONE);
+      } else {
+        release(slot);
+      }
+    } else {
+      // It keeps its place in line, so it goes out again before anything queued after it
+      slot->state = TX_QUEUED;
+      tx_stats.requeued++;
+    }
+    break;
+  }
+
+  mt_txq_service(now);
+}
+
+// Whether any packet is waiting on a Routing reply, which we mustn't filter out
+bool mt_txq_awaiting_ack() {
+  for (int i = 0; i < MT_ACK_WAIT_LEN; i++) {
+    if (ack_waits[i].state != ACK_FREE) return true;
+  }
+  return false;
+}
+
+// Pull the error_reason out of a Routing message. Returns false if it's a route request or reply.
+static bool routing_error(const meshtastic_Data_payload_t * payload, meshtastic_Routing_Error * error) {
+  pb_istream_t stream = pb_istream_from_buffer(payload->bytes, payload->size);
+  pb_wire_type_t wire_type;
+  uint32_t tag, value;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_Routing_error_reason_tag && wire_type == PB_WT_VARINT) {
+      if (!pb_decode_varint32(&stream, &value)) return false;
+      *error = (meshtastic_Routing_Error)value;
+      return true;
+    }
+    if (!pb_skip_field(&stream, wire_type)) return false;
+  }
+  return false;
+}
+
+// Match ACKs and NAKs from the mesh to the packets they answer
+void mt_txq_handle_packet(uint32_t now, const meshtastic_MeshPacket * packet) {
+  if (packet->which_payload_variant != meshtastic_MeshPacket_decoded_tag) return;
+  if (packet->decoded.portnum != meshtastic_PortNum_ROUTING_APP || packet->decoded.request_id == 0) return;
+
+  meshtastic_Routing_Error error;
+  if (!routing_error(&packet->decoded.payload, &error)) return;
+
+  for (int i = 0; i < MT_ACK_WAIT_LEN; i++) {
+    mt_ack_wait_t *ack = &ack_waits[i];
+    if (ack->state == ACK_FREE || ack->packet_id != packet->decoded.request_id) continue;
+    // Nothing can have answered a packet that's waiting to be written again
+    if (ack->state == ACK_QUEUED && tx_slots[ack->slot].state != TX_SENT) continue;
+    if (error == meshtastic_Routing_Error_NONE) {
+      // An ACK from anyone but the destination means only that a neighbour heard it and passed it on
+      bool direct = ack->dest != BROADCAST_ADDR;
+      finish(ack, now, direct && packet->from != ack->dest ? MT_DELIVERY_RELAYED : MT_DELIVERY_ACKED, error);
+    } else if (error == meshtastic_Routing_Error_MAX_RETRANSMIT || error == meshtastic_Routing_Error_TIMEOUT
+               || error == meshtastic_Routing_Error_NO_RESPONSE) {
+      if (!resend(ack)) finish(ack, now, MT_DELIVERY_FAILED, error);
+    } else {
+      finish(ack, now, MT_DELIVERY_FAILED, error);
+    }
+    return;
+  }
+}
+
+// When the queue next needs servicing
+void mt_txq_deadline(uint32_t * next_due) {
+  for (int i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    mt_tx_slot_t *slot = &tx_slots[i];
+    if (slot->state == TX_SENT) mt_due_at(next_due, slot->sent_at + QUEUE_STATUS_TIMEOUT_MS);
+  }
+  for (int i = 0; i < MT_ACK_WAIT_LEN; i++) {
+    mt_ack_wait_t *ack = &ack_waits[i];
+    if (ack->state == ACK_WAITING) mt_due_at(next_due, ack->sent_at + ack_timeout_ms);
+  }
+  if (radio_free == 0 && next_queued(0, false) != NULL) {
+    mt_due_at(next_due, last_status_at + QUEUE_STATUS_TIMEOUT_MS);
+  }
+  if (tx_holding) mt_due_at(next_due, tx_held_at + HOLD_RECHECK_MS);
+}
+
+void mt_get_tx_stats(mt_tx_stats_t * stats) {
+  *stats = tx_stats;
+  stats->radio_free = radio_free;
+  stats->depth = 0;
+  for (int i = 0; i < MT_TX_QUEUE_LEN; i++) {
+    if (tx_slots[i].state == TX_QUEUED || tx_slots[i].state == TX_SENT) stats->depth++;
+  }
+  stats->awaiting_ack = 0;
+  for (int i = 0; i < MT_ACK_WAIT_LEN; i++) {
+    if (ack_waits[i].state != ACK_FREE) stats->awaiting_ack++;
+  }
+}
@@ -32,12 +32,7 @@ bool mt_serial_send_radio(const char * buf, size_t len) {
   size_t wrote = serial->write(buf, len);
   if (wrote == len) return true;
 
-#ifdef MT_DEBUGGING
-    Serial.print("Tried to send radio ");
-    Serial.print(len);
-    Serial.print(" but actually sent ");
-    Serial.println(wrote);
-#endif
+  d("Tried to send radio %u but actually sent %u", (unsigned)len, (unsigned)wrote);
 
   return false;
 }
@@ -46,15 +41,20 @@ bool mt_serial_loop() {
   return true;  // It's easy being a serial interface
 }
 
+// Move up to space_left waiting bytes into buf. Anything that doesn't fit stays in the
+// UART buffer until the next call.
 size_t mt_serial_check_radio(char * buf, size_t space_left) {
   size_t bytes_read = 0;
-  while (serial->available()) {
-    char c = serial->read();
-    *buf++ = c;
-    if (++bytes_read >= space_left) {
-      d("Serial overflow");
-      break;
-    }
+  while (bytes_read < space_left && serial->available()) {
+    *buf++ = serial->read();
+    bytes_read++;
   }
   return bytes_read;
 }
+
+// Read exactly len bytes, waiting up to timeout msec for each one to arrive. Returns how
+// many were read, which is less than len if we timed out.
+size_t mt_serial_read_radio(char * buf, size_t len, uint32_t timeout) {
+  serial->setTimeout(timeout);
+  return serial->readBytes(buf, len);
+}
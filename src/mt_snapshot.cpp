@@ -0,0 +1,285 @@
+#include "mt_internals.h"
+
+#ifdef MT_SNAPSHOT_EEPROM
+#include <EEPROM.h>
+#endif
+
+// Snapshots of what the radio has told us (our node number, its channels and LoRa config, and the
+// node table), so that after a restart the app can get going straight away, and catch up with a
+// sync in the background.
+//
+// A snapshot is laid out like the FromRadio frames of a config dump, run together: the magic
+// number, then one protobuf field per record, numbered as in FromRadio (my_info, channel, config,
+// node_info), each holding the variant's own message. Like a dump it ends with config_complete_id,
+// which here holds the number of records before it, so that a snapshot cut short is caught.
+
+#define SNAPSHOT_MAGIC_0 'M'
+#define SNAPSHOT_MAGIC_1 'T'
+#define SNAPSHOT_MAGIC_2 'S'
+#define SNAPSHOT_VERSION 1
+
+static bool write_record(pb_ostream_t * stream, uint32_t tag, const pb_msgdesc_t * fields, const void * msg) {
+  return pb_encode_tag(stream, PB_WT_STRING, tag) && pb_encode_submessage(stream, fields, msg);
+}
+
+// A node's record, back in the form the radio sent it in
+static void node_to_info(const mt_node_t * node, meshtastic_NodeInfo * info) {
+  memset(info, 0, sizeof(*info));
+  info->num = node->node_num;
+  info->last_heard = node->last_heard_from;
+  info->snr = isnan(node->snr) ? 0 : node->snr;
+  info->has_user = node->has_user;
+  if (node->has_user) {
+    memcpy(info->user.id, node->user_id, MAX_USER_ID_LEN);
+    memcpy(info->user.long_name, node->long_name, MAX_LONG_NAME_LEN);
+    memcpy(info->user.short_name, node->short_name, MAX_SHORT_NAME_LEN);
+  }
+  if (!isnan(node->latitude)) {
+    info->has_position = true;
+    info->position.has_latitude_i = true;
+    info->position.latitude_i = lround(node->latitude * 1e7);
+    info->position.has_longitude_i = true;
+    info->position.longitude_i = lround(node->longitude * 1e7);
+    info->position.has_altitude = true;
+    info->position.altitude = node->altitude;
+    info->position.has_ground_speed = true;
+    info->position.ground_speed = node->ground_speed;
+    info->position.time = node->last_heard_position;
+    info->position.timestamp = node->time_of_last_position;
+  }
+  // Each metric on its own, as a node may have reported some but not others
+  meshtastic_DeviceMetrics *m = &info->device_metrics;
+  m->has_battery_level = node->battery_level != 0;
+  m->battery_level = node->battery_level;
+  m->has_voltage = !isnan(node->voltage);
+  m->voltage = m->has_voltage ? node->voltage : 0;
+  m->has_channel_utilization = !isnan(node->channel_utilization);
+  m->channel_utilization = m->has_channel_utilization ? node->channel_utilization : 0;
+  m->has_air_util_tx = !isnan(node->air_util_tx);
+  m->air_util_tx = m->has_air_util_tx ? node->air_util_tx : 0;
+  info->has_device_metrics = m->has_battery_level || m->has_voltage || m->has_channel_utilization || m->has_air_util_tx;
+}
+
+bool mt_snapshot_save(pb_ostream_t * stream) {
+  const pb_byte_t magic[4] = {SNAPSHOT_MAGIC_0, SNAPSHOT_MAGIC_1, SNAPSHOT_MAGIC_2, SNAPSHOT_VERSION};
+  if (!pb_write(stream, magic, sizeof(magic))) return false;
+  uint32_t records = 0;
+
+  if (my_node_num != 0) {
+    meshtastic_MyNodeInfo my_info = meshtastic_MyNodeInfo_init_zero;
+    my_info.my_node_num = my_node_num;
+    if (!write_record(stream, meshtastic_FromRadio_my_info_tag, meshtastic_MyNodeInfo_fields, &my_info)) return false;
+    records++;
+  }
+
+  for (uint8_t i = 0; i < MT_MAX_CHANNELS; i++) {
+    if (!(channels_seen & (1 << i))) continue;
+    if (!write_record(stream, meshtastic_FromRadio_channel_tag, meshtastic_Channel_fields, &channels[i])) return false;
+    records++;
+  }
+
+  if (have_lora_config) {
+    meshtastic_Config config = meshtastic_Config_init_zero;
+    config.which_payload_variant = meshtastic_Config_lora_tag;
+    config.payload_variant.lora = lora_config;
+    if (!write_record(stream, meshtastic_FromRadio_config_tag, meshtastic_Config_fields, &config)) return false;
+    records++;
+  }
+
+  mt_node_t node;
+  meshtastic_NodeInfo info;
+  for (uint16_t i = 0; mt_nodedb_at(i, &node); i++) {
+    node_to_info(&node, &info);
+    if (!write_record(stream, meshtastic_FromRadio_node_info_tag, meshtastic_NodeInfo_fields, &info)) return false;
+    records++;
+  }
+
+  return pb_encode_tag(stream, PB_WT_VARINT, meshtastic_FromRadio_config_complete_id_tag)
+    && pb_encode_varint(stream, records);
+}
+
+bool mt_snapshot_load(pb_istream_t * stream) {
+  pb_byte_t magic[4];
+  if (!pb_read(stream, magic, sizeof(magic))) return false;
+  if (magic[0] != SNAPSHOT_MAGIC_0 || magic[1] != SNAPSHOT_MAGIC_1 || magic[2] != SNAPSHOT_MAGIC_2
+      || magic[3] != SNAPSHOT_VERSION) {
+    d("Not a snapshot we can read");
+    return false;
+  }
+
+  // Only one record is decoded at a time
+  union {
+    meshtastic_MyNodeInfo my_info;
+    meshtastic_NodeInfo node_info;
+    meshtastic_Config config;
+    meshtastic_Channel channel;
+  } msg;
+  uint32_t records = 0;
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  // The backend may not know where the snapshot ends, so stop at its last field, not at EOF
+  while (pb_decode_tag(stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_FromRadio_config_complete_id_tag && wire_type == PB_WT_VARINT) {
+      uint32_t expected;
+      if (!pb_decode_varint32(stream, &expected)) return false;
+      if (expected != records) d("Snapshot should have had %lu records, not %lu", (unsigned long)expected, (unsigned long)records);
+      return expected == records;
+    }
+
+    const pb_msgdesc_t *fields;
+    switch (tag) {
+      case meshtastic_FromRadio_my_info_tag: fields = meshtastic_MyNodeInfo_fields; break;
+      case meshtastic_FromRadio_node_info_tag: fields = meshtastic_NodeInfo_fields; break;
+      case meshtastic_FromRadio_config_tag: fields = meshtastic_Config_fields; break;
+      case meshtastic_FromRadio_channel_tag: fields = meshtastic_Channel_fields; break;
+      default: fields = NULL; break;
+    }
+    if (fields == NULL || wire_type != PB_WT_STRING) {
+      // Something a later version put in
+      if (!pb_skip_field(stream, wire_type)) return false;
+      records++;
+      continue;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    if (!pb_decode_ex(stream, fields, &msg, PB_DECODE_DELIMITED)) {
+      d("Couldn't decode snapshot record: %s", PB_GET_ERROR(stream));
+      return false;
+    }
+    records++;
+
+    // Handled just as if the radio had sent them, except that nodes go straight into the node
+    // table: their metrics are old news to the airtime governor, and the app didn't ask for a
+    // node report
+    switch (tag) {
+      case meshtastic_FromRadio_my_info_tag: handle_my_info(&msg.my_info); break;
+      case meshtastic_FromRadio_node_info_tag: {
+        mt_node_t node;
+        node_from_info(&msg.node_info, &node);
+        mt_nodedb_put(&node);
+        break;
+      }
+      case meshtastic_FromRadio_config_tag: handle_config_tag(&msg.config); break;
+      case meshtastic_FromRadio_channel_tag: handle_channel_tag(&msg.channel); break;
+    }
+  }
+  d("Snapshot was cut short");
+  return false;
+}
+
+// Arduino streams, such as a file on LittleFS, SPIFFS or an SD card
+
+static bool print_write(pb_ostream_t * stream, const pb_byte_t * buf, size_t count) {
+  return ((Print *)stream->state)->write(buf, count) == count;
+}
+
+static bool stream_read(pb_istream_t * stream, pb_byte_t * buf, size_t count) {
+  return ((Stream *)stream->state)->readBytes((char *)buf, count) == count;
+}
+
+bool mt_snapshot_save_stream(Print & out) {
+  pb_ostream_t stream = PB_OSTREAM_SIZING;
+  stream.callback = &print_write;
+  stream.state = &out;
+  stream.max_size = SIZE_MAX;
+  return mt_snapshot_save(&stream);
+}
+
+bool mt_snapshot_load_stream(Stream & in) {
+  pb_istream_t stream;
+  stream.callback = &stream_read;
+  stream.state = &in;
+  stream.bytes_left = SIZE_MAX;
+#ifndef PB_NO_ERRMSG
+  stream.errmsg = NULL;
+#endif
+  return mt_snapshot_load(&stream);
+}
+
+#ifdef MT_SNAPSHOT_FILES
+// Files on a host with stdio, such as Linux
+
+static bool file_write(pb_ostream_t * stream, const pb_byte_t * buf, size_t count) {
+  return fwrite(buf, 1, count, (FILE *)stream->state) == count;
+}
+
+static bool file_read(pb_istream_t * stream, pb_byte_t * buf, size_t count) {
+  return fread(buf, 1, count, (FILE *)stream->state) == count;
+}
+
+// Written to a temporary file first, so that a crash part way through leaves the old snapshot be
+bool mt_snapshot_save_file(const char * path) {
+  char tmp[256];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return false;
+  FILE *f = fopen(tmp, "wb");
+  if (f == NULL) return false;
+
+  pb_ostream_t stream = PB_OSTREAM_SIZING;
+  stream.callback = &file_write;
+  stream.state = f;
+  stream.max_size = SIZE_MAX;
+  bool ok = mt_snapshot_save(&stream);
+  ok = fclose(f) == 0 && ok;
+  if (ok) ok = rename(tmp, path) == 0;
+  if (!ok) remove(tmp);
+  return ok;
+}
+
+bool mt_snapshot_load_file(const char * path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return false;
+
+  pb_istream_t stream;
+  stream.callback = &file_read;
+  stream.state = f;
+  stream.bytes_left = SIZE_MAX;
+#ifndef PB_NO_ERRMSG
+  stream.errmsg = NULL;
+#endif
+  bool ok = mt_snapshot_load(&stream);
+  fclose(f);
+  return ok;
+}
+#endif
+
+#ifdef MT_SNAPSHOT_EEPROM
+// EEPROM, or the flash that stands in for it on ESP and RP2040 boards. There, EEPROM.begin() has to
+// have been called with a size big enough for the snapshot.
+
+static bool eeprom_write(pb_ostream_t * stream, const pb_byte_t * buf, size_t count) {
+  int *address = (int *)stream->state;
+  for (size_t i = 0; i < count; i++) EEPROM.write((*address)++, buf[i]);
+  return true;
+}
+
+static bool eeprom_read(pb_istream_t * stream, pb_byte_t * buf, size_t count) {
+  int *address = (int *)stream->state;
+  for (size_t i = 0; i < count; i++) buf[i] = EEPROM.read((*address)++);
+  return true;
+}
+
+bool mt_snapshot_save_eeprom(int address, size_t max_len) {
+  pb_ostream_t stream = PB_OSTREAM_SIZING;
+  stream.callback = &eeprom_write;
+  stream.state = &address;
+  stream.max_size = max_len;
+  if (!mt_snapshot_save(&stream)) return false;
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_RP2040)
+  return EEPROM.commit();
+#else
+  return true;
+#endif
+}
+
+bool mt_snapshot_load_eeprom(int address, size_t max_len) {
+  pb_istream_t stream;
+  stream.callback = &eeprom_read;
+  stream.state = &address;
+  stream.bytes_left = max_len;
+#ifndef PB_NO_ERRMSG
+  stream.errmsg = NULL;
+#endif
+  return mt_snapshot_load(&stream);
+}
+#endif
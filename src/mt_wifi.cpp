@@ -40,14 +40,11 @@ void mt_wifi_init(int8_t cs_pin, int8_t irq_pin, int8_t reset_pin,
 
 void print_wifi_status() {
   IPAddress ip = WiFi.localIP();
-  Serial.print("IP Address: ");
-  Serial.println(ip);
+  mt_log("IP Address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
 
   // print the received signal strength:
   long rssi = WiFi.RSSI();
-  Serial.print("Signal strength (RSSI):");
-  Serial.print(rssi);
-  Serial.println(" dBm");
+  mt_log("Signal strength (RSSI):%ld dBm", rssi);
 }
 
 bool open_tcp_connection() {
@@ -128,25 +125,32 @@ bool mt_wifi_loop(uint32_t now) {
 }
 
 // Check for bytes waiting on the TCP connection.
-// If found, add them to buf and return how many were read.
+// If found, add up to space_left of them to buf and return how many were read. Anything that
+// doesn't fit is left on the connection for the next call.
 size_t mt_wifi_check_radio(char * buf, size_t space_left) {
   if (!client.connected()) {
     d("Lost TCP connection");
     return 0;
   }
   size_t bytes_read = 0;
-  while (client.available()) {
-    char c = client.read();
-    *buf++ = c;
-    if (++bytes_read >= space_left) {
-      d("TCP overflow");
-      client.stop();
-      break;
-    }
+  while (bytes_read < space_left && client.available()) {
+    *buf++ = client.read();
+    bytes_read++;
   }
   return bytes_read;
 }
 
+// Read exactly len bytes from the TCP connection, waiting up to timeout msec for each one to
+// arrive. Returns how many were read, which is less than len if we timed out.
+size_t mt_wifi_read_radio(char * buf, size_t len, uint32_t timeout) {
+  if (!client.connected()) {
+    d("Lost TCP connection");
+    return 0;
+  }
+  client.setTimeout(timeout);
+  return client.readBytes(buf, len);
+}
+
 // Send a packet over the TCP connection
 bool mt_wifi_send_radio(const char * buf, size_t len) {
   if (!client.connected()) {
@@ -164,16 +168,16 @@ bool mt_wifi_send_radio(const char * buf, size_t len) {
   size_t wrote = client.write(buf, len);
   if (wrote == len) return true;
 
-#ifdef MT_DEBUGGING
-    Serial.print("Tried to send radio ");
-    Serial.print(len);
-    Serial.print(" but actually sent ");
-    Serial.println(wrote);
-#endif
+  d("Tried to send radio %u but actually sent %u", (unsigned)len, (unsigned)wrote);
   client.stop();
   return false;
 }
 
+// When mt_wifi_loop() next needs to run: a connect attempt, or the idle timeout
+uint32_t mt_wifi_next_deadline() {
+  return next_connect_attempt;
+}
+
 // Call this whenever we receive a node report. If we go too long without one,
 // we'll reset the connection and start over from the beginning.
 void mt_wifi_reset_idle_timeout(uint32_t now) {
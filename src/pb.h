@@ -40,6 +40,15 @@
  * Such example is older protobuf.js. */
 /* #define PB_ENCODE_ARRAYS_UNPACKED 1 */
 
+/* Encode submessages into memory buffers in a single pass: reserve room
+ * for the length prefix, encode, then back-patch the length (moving the
+ * submessage down if the prefix turned out shorter). Without this, each
+ * submessage is first walked by a sizing pass, so nested messages are
+ * walked once per level of nesting. Define as 0 to turn it off. */
+#ifndef PB_ENCODE_BACKPATCH
+#define PB_ENCODE_BACKPATCH 1
+#endif
+
 /* Enable conversion of doubles to floats for platforms that do not
  * support 64-bit doubles. Most commonly AVR. */
 /* #define PB_CONVERT_DOUBLE_FLOAT 1 */
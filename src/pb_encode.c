@@ -721,6 +721,55 @@ bool checkreturn pb_encode_string(pb_ostream_t *stream, const pb_byte_t *buffer,
     return pb_write(stream, buffer, size);
 }
 
+#if PB_ENCODE_BACKPATCH
+static size_t varint_size(size_t value)
+{
+    size_t n = 1;
+    while (value > 0x7F)
+    {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+/* Encode a submessage straight into a memory buffer, leaving room for a
+ * length prefix wide enough for anything that could fit, and fill it in
+ * once the real size is known. */
+static bool checkreturn encode_submessage_backpatch(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src_struct)
+{
+    pb_byte_t *start = (pb_byte_t*)stream->state;
+    size_t room = stream->max_size - stream->bytes_written;
+    size_t reserved = varint_size(room);
+    pb_ostream_t substream;
+    size_t size, width;
+    bool status;
+
+    if (room < reserved)
+        PB_RETURN_ERROR(stream, "stream full");
+
+    substream = pb_ostream_from_buffer(start + reserved, room - reserved);
+    status = pb_encode(&substream, fields, src_struct);
+#ifndef PB_NO_ERRMSG
+    stream->errmsg = substream.errmsg;
+#endif
+    if (!status)
+        return false;
+
+    size = substream.bytes_written;
+    width = varint_size(size);
+    if (width < reserved)
+        memmove(start + width, start + reserved, size);
+
+    if (!pb_encode_varint(stream, (pb_uint64_t)size))
+        return false;
+
+    stream->state = start + width + size;
+    stream->bytes_written += size;
+    return true;
+}
+#endif
+
 bool checkreturn pb_encode_submessage(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src_struct)
 {
     /* First calculate the message size using a non-writing substream. */
@@ -728,6 +777,15 @@ bool checkreturn pb_encode_submessage(pb_ostream_t *stream, const pb_msgdesc_t *
     size_t size;
     bool status;
     
+#if PB_ENCODE_BACKPATCH
+#ifdef PB_BUFFER_ONLY
+    if (stream->callback != NULL)
+#else
+    if (stream->callback == &buf_write)
+#endif
+        return encode_submessage_backpatch(stream, fields, src_struct);
+#endif
+
     if (!pb_encode(&substream, fields, src_struct))
     {
 #ifndef PB_NO_ERRMSG
@@ -0,0 +1,108 @@
+// Packets waiting on an ACK are tracked apart from the TX queue, so they don't hold its slots once
+// the radio has taken them, unless they may have to be resent.
+#include "radio.h"
+
+#define ACK_WAITS 4  // MT_ACK_WAIT_LEN's default
+
+static int acked = 0, timed_out = 0;
+static uint32_t last_rtt = 0;
+
+static void on_delivery(uint32_t packet_id, uint32_t dest, mt_delivery_t result, meshtastic_Routing_Error error,
+                        uint32_t rtt_ms) {
+  if (result == MT_DELIVERY_ACKED) acked++;
+  if (result == MT_DELIVERY_TIMED_OUT) timed_out++;
+  last_rtt = rtt_ms;
+}
+
+// The radio takes every packet it's been written
+static std::vector<uint32_t> radio_takes_all() {
+  std::vector<uint32_t> ids;
+  for (const meshtastic_ToRadio & t : radio_received()) {
+    if (t.which_payload_variant != meshtastic_ToRadio_packet_tag) continue;
+    ids.push_back(t.packet.id);
+    radio_send(radio_queue_status(t.packet.id, 16));
+  }
+  mt_poll(millis(), NULL, NULL);
+  return ids;
+}
+
+static void radio_acks(uint32_t id, uint32_t from) {
+  meshtastic_FromRadio f = meshtastic_FromRadio_init_zero;
+  f.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  f.packet.from = from;
+  f.packet.to = 0x1234;
+  f.packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  f.packet.decoded.portnum = meshtastic_PortNum_ROUTING_APP;
+  f.packet.decoded.request_id = id;
+  f.packet.decoded.payload.size = 2;
+  f.packet.decoded.payload.bytes[0] = meshtastic_Routing_error_reason_tag << 3;
+  f.packet.decoded.payload.bytes[1] = meshtastic_Routing_Error_NONE;
+  radio_send(f);
+  mt_poll(millis(), NULL, NULL);
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  set_delivery_callback(on_delivery);
+  mt_tx_stats_t tx;
+
+  // Without resends, a packet's slot is freed as soon as the radio takes it, so as many can wait
+  // on ACKs as the table holds, and no more
+  int sent = 0;
+  while (mt_send_text("Anyone there?", 0x5678)) {
+    sent++;
+    radio_takes_all();
+  }
+  mt_get_tx_stats(&tx);
+  printf("%d waiting on ACKs, %u in the TX queue\n", tx.awaiting_ack, tx.depth);
+  CHECK(sent == ACK_WAITS && tx.awaiting_ack == ACK_WAITS && tx.depth == 0);
+
+  // Packets without want_ack still go while they wait
+  mt_bytes_t payload = {(const uint8_t *)"hi", 2};
+  CHECK(mt_send_data(meshtastic_PortNum_TEXT_MESSAGE_APP, payload, BROADCAST_ADDR, 0, false));
+  CHECK(radio_takes_all().size() == 1);
+
+  // They're answered, or time out, all the same
+  stub_millis += 1000;
+  radio_acks(12345, 0x5678);  // For a packet nobody sent
+  mt_get_tx_stats(&tx);
+  CHECK(tx.awaiting_ack == ACK_WAITS);
+  stub_millis += 60000;
+  mt_poll(millis(), NULL, NULL);
+  CHECK(timed_out == ACK_WAITS && acked == 0);
+
+  // With resends, the frame is kept to be written again
+  mt_set_delivery_policy(5000, 1);
+  uint32_t packet_id;
+  CHECK(mt_send_data(meshtastic_PortNum_TEXT_MESSAGE_APP, payload, 0x5678, 0, true, &packet_id));
+  CHECK(radio_takes_all().size() == 1);
+  mt_get_tx_stats(&tx);
+  CHECK(tx.awaiting_ack == 1 && tx.depth == 0);
+  stub_millis += 5000;
+  mt_poll(millis(), NULL, NULL);
+  std::vector<uint32_t> ids = radio_takes_all();
+  CHECK(ids.size() == 1 && ids[0] == packet_id);
+  stub_millis += 300;
+  radio_acks(packet_id, 0x5678);
+  CHECK(acked == 1 && last_rtt == 300);
+  mt_get_tx_stats(&tx);
+  CHECK(tx.awaiting_ack == 0 && tx.resent == 1);
+
+  // The deadline from mt_poll() takes in the frames it handled: here the radio takes a packet,
+  // which starts its ACK timeout
+  mt_set_delivery_policy(300, 0);
+  CHECK(mt_send_data(meshtastic_PortNum_TEXT_MESSAGE_APP, payload, 0x5678, 0, true, &packet_id));
+  CHECK(radio_received().size() == 1);
+  radio_send(radio_queue_status(packet_id, 16));
+  uint32_t due;
+  mt_poll(millis(), &due, NULL);
+  CHECK(due - millis() == 300);
+
+  // Delivery stats are kept for every destination while there's room, even ones first sent to in
+  // the same millisecond
+  mt_link_stats_t link;
+  CHECK(mt_send_data(meshtastic_PortNum_TEXT_MESSAGE_APP, payload, 0x1111, 0, true));
+  CHECK(mt_send_data(meshtastic_PortNum_TEXT_MESSAGE_APP, payload, 0x2222, 0, true));
+  CHECK(mt_get_link_stats(0x5678, &link) && mt_get_link_stats(0x1111, &link) && mt_get_link_stats(0x2222, &link));
+  return 0;
+}
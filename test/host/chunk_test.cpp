@@ -0,0 +1,71 @@
+// build flags: -DMT_CHUNK_MAX_COUNT=8
+// Large messages come in as chunks on MT_CHUNK_PORT. They're only taken once the app asks for
+// them, a chunk with no data is ignored, and a chunk that turns up after its message is complete
+// doesn't start it over.
+#include "mesh_mix.h"
+
+#define CHUNK_SIZE 225
+#define OTHER 0x5678
+
+static int messages = 0, port_packets = 0;
+static std::string message;
+
+static void on_message(uint32_t from, uint32_t to, uint8_t channel, mt_bytes_t data) {
+  messages++;
+  message.assign((const char *)data.data, data.len);
+}
+
+static void on_packet(const mt_packet_meta_t * meta, mt_bytes_t payload) {
+  if (meta->portnum == MT_CHUNK_PORT) port_packets++;
+}
+
+static void send_chunk(uint32_t payload_id, uint16_t count, uint16_t index, const std::string & data) {
+  meshtastic_ChunkedPayload c = meshtastic_ChunkedPayload_init_zero;
+  c.payload_id = payload_id;
+  c.chunk_count = count;
+  c.chunk_index = index;
+  c.payload_chunk.size = data.size();
+  memcpy(c.payload_chunk.bytes, data.data(), data.size());
+  meshtastic_FromRadio f = mix_packet(OTHER, MT_CHUNK_PORT, meshtastic_ChunkedPayload_fields, &c);
+  f.packet.to = my_node_num;
+  radio_send(f);
+  mt_poll(millis(), NULL, NULL);
+}
+
+// How many chunk responses the library has written since last asked
+static int responses() {
+  int n = 0;
+  for (const meshtastic_ToRadio & t : radio_received()) {
+    if (t.which_payload_variant == meshtastic_ToRadio_packet_tag && t.packet.decoded.portnum == MT_CHUNK_RESPONSE_PORT) n++;
+  }
+  return n;
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  my_node_num = 0x1234;
+  set_packet_callback(on_packet);
+  std::string first(CHUNK_SIZE, 'a'), last(100, 'b');
+
+  // Without a large message callback, chunks are packets like any others
+  send_chunk(1, 2, 0, first);
+  CHECK(port_packets == 1 && messages == 0);
+
+  set_large_message_callback(on_message);
+  send_chunk(2, 2, 0, first);
+  send_chunk(2, 2, 1, last);
+  CHECK(port_packets == 1 && messages == 1 && message == first + last);
+  CHECK(responses() == 1);  // accept_transfer
+
+  // A chunk of it that turns up late is dropped, rather than starting the message over and asking
+  // for the chunks it's missing
+  send_chunk(2, 2, 0, first);
+  stub_millis += 60000;
+  mt_poll(millis(), NULL, NULL);
+  CHECK(messages == 1 && responses() == 0);
+
+  // A chunk without any data is no chunk at all
+  send_chunk(3, 1, 0, "");
+  CHECK(messages == 1);
+  return 0;
+}
@@ -0,0 +1,109 @@
+// The text codec hook, with a run-length codec standing in for unishox2: text goes out compressed
+// when that's shorter and plain when it isn't, and compressed text that comes back is decompressed
+// for the text message callback. Without a codec, it's handed to the portnum callback as is.
+#include "radio.h"
+
+#define OTHER 0x5678
+
+static std::string heard;
+static int texts = 0, compressed_packets = 0;
+
+// Each run of up to 255 of the same character as a count and the character
+static size_t rle_compress(const char * text, size_t len, uint8_t * out, size_t out_size) {
+  size_t n = 0;
+  for (size_t i = 0; i < len;) {
+    size_t run = 1;
+    while (i + run < len && run < 255 && text[i + run] == text[i]) run++;
+    if (n + 2 > out_size) return 0;
+    out[n++] = run;
+    out[n++] = text[i];
+    i += run;
+  }
+  return n;
+}
+
+static size_t rle_decompress(const uint8_t * data, size_t len, char * out, size_t out_size) {
+  size_t n = 0;
+  if (len % 2 != 0) return 0;
+  for (size_t i = 0; i < len; i += 2) {
+    if (data[i] == 0 || n + data[i] > out_size) return 0;
+    memset(out + n, data[i + 1], data[i]);
+    n += data[i];
+  }
+  return n;
+}
+
+static void on_text(uint32_t from, uint32_t to, uint8_t channel, const char * text) {
+  texts++;
+  heard = text;
+}
+
+static void on_port(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t * payload) {
+  if (port == meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP) compressed_packets++;
+}
+
+// Send a text, and return the packet the library wrote for it
+static meshtastic_MeshPacket sent(const std::string & text) {
+  CHECK(mt_send_text(text.c_str()));
+  std::vector<meshtastic_ToRadio> written = radio_received();
+  CHECK(written.size() == 1 && written[0].which_payload_variant == meshtastic_ToRadio_packet_tag);
+  radio_send(radio_queue_status(written[0].packet.id, 16));
+  mt_poll(millis(), NULL, NULL);
+  return written[0].packet;
+}
+
+// The same packet coming back from another node
+static void echo(const meshtastic_MeshPacket & packet) {
+  meshtastic_FromRadio f = meshtastic_FromRadio_init_zero;
+  f.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  f.packet = packet;
+  f.packet.from = OTHER;
+  radio_send(f);
+  mt_poll(millis(), NULL, NULL);
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  mt_poll(millis(), NULL, NULL);  // Gets the first heartbeat out of the way
+  serial->out.clear();
+  set_text_message_callback(on_text);
+  set_portnum_callback(on_port);
+  mt_set_text_codec(rle_compress, rle_decompress);
+
+  // Shorter compressed, so it goes compressed, and comes back as it was
+  std::string text = std::string(40, 'a') + std::string(30, 'b') + "!";
+  meshtastic_MeshPacket p = sent(text);
+  CHECK(p.decoded.portnum == meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP && p.decoded.payload.size == 6);
+  echo(p);
+  CHECK(texts == 1 && heard == text);
+
+  // Longer compressed, so it goes plain
+  text = "No runs here";
+  p = sent(text);
+  CHECK(p.decoded.portnum == meshtastic_PortNum_TEXT_MESSAGE_APP && p.decoded.payload.size == text.size());
+  echo(p);
+  CHECK(texts == 2 && heard == text);
+
+  // As long as a packet holds, compressed, and back again
+  text = std::string(meshtastic_Constants_DATA_PAYLOAD_LEN, 'z');
+  p = sent(text);
+  CHECK(p.decoded.portnum == meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP);
+  echo(p);
+  CHECK(texts == 3 && heard == text);
+
+  // Any longer is refused, even though it would compress, as it couldn't be decompressed here
+  text += "z";
+  CHECK(!mt_send_text(text.c_str()));
+
+  // Compressed text that doesn't decompress is dropped
+  p.decoded.payload.size = 3;
+  echo(p);
+  CHECK(texts == 3 && compressed_packets == 0);
+
+  // With no codec, compressed text goes to the portnum callback untouched
+  mt_set_text_codec(NULL, NULL);
+  p.decoded.payload.size = 2;
+  echo(p);
+  CHECK(texts == 3 && compressed_packets == 1);
+  return 0;
+}
@@ -0,0 +1,65 @@
+// How long encoding takes for a ToRadio holding a text packet and for an AdminMessage setting the
+// LoRa config (the two the library sends most), with nanopb's single-pass submessage encoding.
+// nobackpatch_bench builds the same thing with PB_ENCODE_BACKPATCH=0, which sizes each submessage
+// in a pass of its own first. Each message is also encoded through a callback stream, which never
+// back-patches, to check the bytes come out the same.
+#include "mesh_mix.h"
+#include "meshtastic/admin.pb.h"
+
+#define ENCODES 200000
+
+static bool string_write(pb_ostream_t * stream, const pb_byte_t * buf, size_t count) {
+  ((std::string *)stream->state)->append((const char *)buf, count);
+  return true;
+}
+
+static void bench(const char * name, const pb_msgdesc_t * fields, const void * msg) {
+  static pb_byte_t buf[meshtastic_ToRadio_size];
+  size_t len = 0;
+  double start = seconds();
+  for (int i = 0; i < ENCODES; i++) {
+    pb_ostream_t stream = pb_ostream_from_buffer(buf, sizeof(buf));
+    CHECK(pb_encode(&stream, fields, msg));
+    len = stream.bytes_written;
+  }
+  double secs = seconds() - start;
+
+  std::string expected;
+  pb_ostream_t stream = {&string_write, &expected, SIZE_MAX, 0};
+  CHECK(pb_encode(&stream, fields, msg));
+  CHECK(expected == std::string((const char *)buf, len));
+  printf("  %-12s %3zu bytes  %6.2f us\n", name, len, secs * 1e6 / ENCODES);
+}
+
+int main() {
+#if PB_ENCODE_BACKPATCH
+  printf("single pass\n");
+#else
+  printf("with a sizing pass per submessage\n");
+#endif
+
+  const char *text = "Heading to the trailhead, back by six";
+  meshtastic_ToRadio to = meshtastic_ToRadio_init_zero;
+  to.which_payload_variant = meshtastic_ToRadio_packet_tag;
+  to.packet.to = 0x1234;
+  to.packet.id = 0x5678abcd;
+  to.packet.want_ack = true;
+  to.packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  to.packet.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+  to.packet.decoded.payload.size = strlen(text);
+  memcpy(to.packet.decoded.payload.bytes, text, to.packet.decoded.payload.size);
+  bench("MeshPacket", meshtastic_ToRadio_fields, &to);
+
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_set_config_tag;
+  admin.set_config.which_payload_variant = meshtastic_Config_lora_tag;
+  meshtastic_Config_LoRaConfig *lora = &admin.set_config.payload_variant.lora;
+  lora->use_preset = true;
+  lora->modem_preset = meshtastic_Config_LoRaConfig_ModemPreset_LONG_FAST;
+  lora->region = meshtastic_Config_LoRaConfig_RegionCode_EU_868;
+  lora->hop_limit = 3;
+  lora->tx_enabled = true;
+  lora->tx_power = 27;
+  bench("AdminMessage", meshtastic_AdminMessage_fields, &admin);
+  return 0;
+}
@@ -0,0 +1,86 @@
+// Packets are encoded straight onto the end of the TX queue's pool in one pass, with the length
+// back-patched. Whatever the length comes to, the frame should be just what pb_encode() makes of
+// the equivalent ToRadio, and a packet that doesn't fit in what's left of the pool is turned away.
+#include "radio.h"
+
+// The frame the radio should get for a packet
+static std::string expected(const meshtastic_MeshPacket & packet) {
+  meshtastic_ToRadio t = meshtastic_ToRadio_init_zero;
+  t.which_payload_variant = meshtastic_ToRadio_packet_tag;
+  t.packet = packet;
+  uint8_t buf[4 + meshtastic_ToRadio_size];
+  pb_ostream_t stream = pb_ostream_from_buffer(buf + 4, meshtastic_ToRadio_size);
+  CHECK(pb_encode(&stream, meshtastic_ToRadio_fields, &t));
+  buf[0] = 0x94;
+  buf[1] = 0xc3;
+  buf[2] = stream.bytes_written >> 8;
+  buf[3] = stream.bytes_written & 0xff;
+  return std::string((const char *)buf, 4 + stream.bytes_written);
+}
+
+static meshtastic_MeshPacket text_packet(uint32_t id, const std::string & text) {
+  meshtastic_MeshPacket p = meshtastic_MeshPacket_init_zero;
+  p.to = 0x5678;
+  p.channel = 1;
+  p.id = id;
+  p.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  p.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+  p.decoded.payload.size = text.size();
+  memcpy(p.decoded.payload.bytes, text.data(), text.size());
+  p.priority = meshtastic_MeshPacket_Priority_DEFAULT;
+  return p;
+}
+
+// Take the frame the library just wrote, and tell it the radio took it
+static std::string written(uint32_t id) {
+  std::string frame = serial->out;
+  serial->out.clear();
+  radio_send(radio_queue_status(id, 16));
+  mt_poll(millis(), NULL, NULL);
+  return frame;
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  mt_poll(millis(), NULL, NULL);  // Gets the first heartbeat out of the way
+  serial->out.clear();
+
+  // Lengths either side of where the packet's own length takes a second byte
+  const size_t lengths[] = {0, 1, 90, 110, 130, 200, meshtastic_Constants_DATA_PAYLOAD_LEN};
+  for (size_t len : lengths) {
+    std::string text(len, 'a' + len % 26);
+    uint32_t id;
+    mt_bytes_t payload = {(const uint8_t *)text.data(), text.size()};
+    CHECK(mt_send_data(meshtastic_PortNum_TEXT_MESSAGE_APP, payload, 0x5678, 1, false, &id));
+    meshtastic_MeshPacket p = text_packet(id, text);
+    CHECK(written(id) == expected(p));
+
+    // With no priority of its own, a packet gets its port's, tacked on the end
+    p.id++;
+    p.priority = meshtastic_MeshPacket_Priority_UNSET;
+    CHECK(mt_send_packet(&p));
+    p.priority = meshtastic_MeshPacket_Priority_DEFAULT;
+    CHECK(written(p.id) == expected(p));
+  }
+
+  // The radio's full, so the pool fills up with the largest packets, until one doesn't fit
+  std::string text(meshtastic_Constants_DATA_PAYLOAD_LEN, 'z');
+  mt_bytes_t payload = {(const uint8_t *)text.data(), text.size()};
+  radio_send(radio_queue_status(0, 0));
+  mt_poll(millis(), NULL, NULL);
+  std::vector<uint32_t> ids;
+  uint32_t id;
+  while (mt_send_data(meshtastic_PortNum_TEXT_MESSAGE_APP, payload, 0x5678, 1, false, &id)) ids.push_back(id);
+  mt_tx_stats_t tx;
+  mt_get_tx_stats(&tx);
+  printf("%u packets of %u bytes queued before the pool was full\n", (unsigned)ids.size(), (unsigned)text.size());
+  CHECK(ids.size() >= 2 && tx.depth == ids.size() && tx.dropped == 1);
+
+  // Once there's room, they all go out whole
+  radio_send(radio_queue_status(0, 16));
+  mt_poll(millis(), NULL, NULL);
+  std::string expected_out;
+  for (uint32_t queued : ids) expected_out += expected(text_packet(queued, text));
+  CHECK(serial->out == expected_out);
+  return 0;
+}
@@ -0,0 +1,28 @@
+// build flags: -DMT_PEEK_FILTER
+// Without a node table, the only telemetry worth decoding is our own node's, for its channel
+// utilization. Everyone else's is skipped unread.
+#include "mesh_mix.h"
+
+static int frames_decoded(const meshtastic_FromRadio & f) {
+  mt_rx_stats_t before, after;
+  mt_get_rx_stats(&before);
+  radio_send(f);
+  uint16_t handled;
+  mt_poll(millis(), NULL, &handled);
+  mt_get_rx_stats(&after);
+  CHECK(handled == 1 && after.decode_errors == before.decode_errors);
+  return 1 - (after.frames_filtered - before.frames_filtered);
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  my_node_num = 0x1234;
+
+  meshtastic_Telemetry t = meshtastic_Telemetry_init_zero;
+  t.which_variant = meshtastic_Telemetry_device_metrics_tag;
+  t.variant.device_metrics.has_channel_utilization = true;
+  t.variant.device_metrics.channel_utilization = 12.5f;
+  CHECK(frames_decoded(mix_packet(0x5678, meshtastic_PortNum_TELEMETRY_APP, meshtastic_Telemetry_fields, &t)) == 0);
+  CHECK(frames_decoded(mix_packet(0x1234, meshtastic_PortNum_TELEMETRY_APP, meshtastic_Telemetry_fields, &t)) == 1);
+  return 0;
+}
@@ -0,0 +1,94 @@
+// A stream of FromRadio frames like a busy mesh sends, for the benchmarks: mostly text, positions,
+// telemetry and node info, with the odd routing reply and log record, in about the proportions
+// seen on a public channel.
+#ifndef MESH_MIX_H
+#define MESH_MIX_H
+
+#include <time.h>
+#include "radio.h"
+
+static inline meshtastic_FromRadio mix_packet(uint32_t from, meshtastic_PortNum port, const pb_msgdesc_t * fields,
+                                               const void * msg) {
+  meshtastic_FromRadio f = meshtastic_FromRadio_init_zero;
+  f.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  f.packet.from = from;
+  f.packet.to = BROADCAST_ADDR;
+  f.packet.id = rand();
+  f.packet.rx_time = 1700000000 + rand() % 1000;
+  f.packet.rx_snr = (rand() % 80 - 40) / 4.0f;
+  f.packet.hop_limit = 3;
+  f.packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  f.packet.decoded.portnum = port;
+  pb_ostream_t stream = pb_ostream_from_buffer(f.packet.decoded.payload.bytes, sizeof(f.packet.decoded.payload.bytes));
+  CHECK(pb_encode(&stream, fields, msg));
+  f.packet.decoded.payload.size = stream.bytes_written;
+  return f;
+}
+
+static inline std::string mix_frame(int i) {
+  uint32_t from = 0x10000 + rand() % 100;
+  int kind = rand() % 20;
+  if (kind < 8) {
+    std::string text(10 + rand() % 110, 'a' + i % 26);
+    meshtastic_FromRadio f = radio_text(from, BROADCAST_ADDR, text.c_str());
+    f.packet.id = rand();
+    f.packet.rx_time = 1700000000;
+    return radio_frame(f);
+  } else if (kind < 12) {
+    meshtastic_Position pos = meshtastic_Position_init_zero;
+    pos.has_latitude_i = pos.has_longitude_i = pos.has_altitude = true;
+    pos.latitude_i = 515000000 + rand() % 100000;
+    pos.longitude_i = -1200000 + rand() % 100000;
+    pos.altitude = 40;
+    pos.time = 1700000000;
+    pos.precision_bits = 32;
+    return radio_frame(mix_packet(from, meshtastic_PortNum_POSITION_APP, meshtastic_Position_fields, &pos));
+  } else if (kind < 16) {
+    meshtastic_Telemetry t = meshtastic_Telemetry_init_zero;
+    t.time = 1700000000;
+    t.which_variant = meshtastic_Telemetry_device_metrics_tag;
+    t.variant.device_metrics.has_battery_level = t.variant.device_metrics.has_voltage = true;
+    t.variant.device_metrics.has_channel_utilization = t.variant.device_metrics.has_air_util_tx = true;
+    t.variant.device_metrics.battery_level = 80;
+    t.variant.device_metrics.voltage = 3.9f;
+    t.variant.device_metrics.channel_utilization = 12.5f;
+    t.variant.device_metrics.air_util_tx = 1.5f;
+    return radio_frame(mix_packet(from, meshtastic_PortNum_TELEMETRY_APP, meshtastic_Telemetry_fields, &t));
+  } else if (kind < 18) {
+    meshtastic_User u = meshtastic_User_init_zero;
+    snprintf(u.id, sizeof(u.id), "!%08x", (unsigned)from);
+    snprintf(u.long_name, sizeof(u.long_name), "Meshtastic %04x", (unsigned)(from & 0xffff));
+    snprintf(u.short_name, sizeof(u.short_name), "%04x", (unsigned)(from & 0xffff));
+    u.hw_model = meshtastic_HardwareModel_TBEAM;
+    return radio_frame(mix_packet(from, meshtastic_PortNum_NODEINFO_APP, meshtastic_User_fields, &u));
+  } else if (kind < 19) {
+    meshtastic_Routing r = meshtastic_Routing_init_zero;
+    r.which_variant = meshtastic_Routing_error_reason_tag;
+    meshtastic_FromRadio f = mix_packet(from, meshtastic_PortNum_ROUTING_APP, meshtastic_Routing_fields, &r);
+    f.packet.decoded.request_id = rand();
+    return radio_frame(f);
+  } else {
+    meshtastic_FromRadio f = meshtastic_FromRadio_init_zero;
+    f.which_payload_variant = meshtastic_FromRadio_log_record_tag;
+    snprintf(f.log_record.message, sizeof(f.log_record.message), "Received text msg from=0x%x, id=0x%x",
+             (unsigned)from, (unsigned)rand());
+    snprintf(f.log_record.source, sizeof(f.log_record.source), "Router");
+    f.log_record.level = meshtastic_LogRecord_Level_INFO;
+    return radio_frame(f);
+  }
+}
+
+static inline std::vector<std::string> mesh_mix(int n) {
+  srand(1);
+  std::vector<std::string> frames;
+  for (int i = 0; i < n; i++) frames.push_back(mix_frame(i));
+  return frames;
+}
+
+static inline double seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif
@@ -0,0 +1,2 @@
+// build flags: -DPB_ENCODE_BACKPATCH=0
+#include "encode_bench.cpp"
@@ -0,0 +1,53 @@
+// build flags: -DMT_NODEDB_SIZE=300
+// The names pool: every node fits with a name of its own, a name shared by more than 255 nodes is
+// still freed when the last one lets go, and names that don't fit are counted.
+#include "radio.h"
+#include "mt_internals.h"
+
+extern uint16_t names_used;
+
+static void put(uint32_t num, const char * long_name, const char * short_name) {
+  mt_node_t node;
+  memset(&node, 0, sizeof(node));
+  node.node_num = num;
+  node.has_user = true;
+  snprintf(node.user_id, sizeof(node.user_id), "!%08lx", (unsigned long)num);  // Made up, takes no room
+  strncpy(node.long_name, long_name, sizeof(node.long_name));
+  strncpy(node.short_name, short_name, sizeof(node.short_name));
+  node.latitude = node.longitude = NAN;
+  node.voltage = node.channel_utilization = node.air_util_tx = node.snr = NAN;
+  node.last_heard_from = num;
+  mt_nodedb_put(&node);
+}
+
+int main() {
+  char long_name[40], short_name[8];
+
+  // A full table of nodes with a dozen-character long name and a four-character short one each
+  for (uint32_t i = 1; i <= MT_NODEDB_SIZE; i++) {
+    snprintf(long_name, sizeof(long_name), "Station %04lu", (unsigned long)i);
+    snprintf(short_name, sizeof(short_name), "S%03lu", (unsigned long)i);
+    put(i, long_name, short_name);
+  }
+  CHECK(mt_nodedb_count() == MT_NODEDB_SIZE);
+  CHECK(mt_nodedb_names_lost() == 0);
+  mt_node_t node;
+  CHECK(mt_nodedb_find(MT_NODEDB_SIZE, &node) && strcmp(node.long_name, "Station 0300") == 0);
+
+  // Every node renamed to the same thing, then all away from it again
+  for (uint32_t i = 1; i <= MT_NODEDB_SIZE; i++) put(i, "Base", "BASE");
+  CHECK(names_used == 2 * 3 + 8);
+  for (uint32_t i = 1; i <= MT_NODEDB_SIZE; i++) put(i, "Relay", "RLY");
+  CHECK(names_used == 2 * 3 + 8);
+  CHECK(mt_nodedb_find(1, &node) && strcmp(node.long_name, "Relay") == 0);
+
+  // More than fits: a long name of 27 characters for every node
+  for (uint32_t i = 1; i <= MT_NODEDB_SIZE; i++) {
+    snprintf(long_name, sizeof(long_name), "Repeater on the hill %06lu", (unsigned long)i);
+    put(i, long_name, "RLY");
+  }
+  CHECK(mt_nodedb_names_lost() > 0);
+  CHECK(names_used <= MT_NODEDB_SIZE * 24);
+  printf("%lu of %u names lost\n", (unsigned long)mt_nodedb_names_lost(), MT_NODEDB_SIZE);
+  return 0;
+}
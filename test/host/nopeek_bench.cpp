@@ -0,0 +1 @@
+#include "peek_bench.cpp"
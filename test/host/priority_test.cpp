@@ -0,0 +1,61 @@
+// Queued packets are aged up as they wait, but only as far as the next priority level: an old
+// BACKGROUND packet goes ahead of a new DEFAULT one, and nothing that's merely been waiting goes
+// ahead of a new HIGH one.
+#include "radio.h"
+
+static uint32_t send(meshtastic_PortNum port) {
+  uint32_t id;
+  mt_bytes_t payload = {(const uint8_t *)"data", 4};
+  CHECK(mt_send_data(port, payload, BROADCAST_ADDR, 0, false, &id));
+  return id;
+}
+
+// Let time pass, with the radio saying all along that it's still full
+static void wait(uint32_t ms) {
+  for (uint32_t waited = 0; waited < ms; waited += 1000) {
+    stub_millis += 1000;
+    radio_send(radio_queue_status(0, 0));
+    mt_poll(millis(), NULL, NULL);
+  }
+}
+
+// Give the radio room for one packet, and return the one it gets
+static uint32_t written() {
+  radio_send(radio_queue_status(0, 1));
+  mt_poll(millis(), NULL, NULL);
+  std::vector<meshtastic_ToRadio> packets;
+  for (const meshtastic_ToRadio & t : radio_received()) {
+    if (t.which_payload_variant == meshtastic_ToRadio_packet_tag) packets.push_back(t);  // Not heartbeats
+  }
+  CHECK(packets.size() == 1);
+  radio_send(radio_queue_status(packets[0].packet.id, 0));
+  mt_poll(millis(), NULL, NULL);
+  return packets[0].packet.id;
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  wait(1000);
+  serial->out.clear();
+
+  // Telemetry and a text that have waited ten minutes for a radio that's full
+  uint32_t telemetry = send(meshtastic_PortNum_TELEMETRY_APP);
+  uint32_t old_text = send(meshtastic_PortNum_TEXT_MESSAGE_APP);
+  wait(600000);
+
+  // An alert still goes first, then the old text, then the telemetry, even ahead of a new text
+  uint32_t alert = send(meshtastic_PortNum_DETECTION_SENSOR_APP);
+  uint32_t new_text = send(meshtastic_PortNum_TEXT_MESSAGE_APP);
+  CHECK(written() == alert);
+  CHECK(written() == old_text);
+  CHECK(written() == telemetry);
+  CHECK(written() == new_text);
+
+  // Not so soon, though: after a few seconds, telemetry's still behind a new text
+  telemetry = send(meshtastic_PortNum_TELEMETRY_APP);
+  wait(5000);
+  new_text = send(meshtastic_PortNum_TEXT_MESSAGE_APP);
+  CHECK(written() == new_text);
+  CHECK(written() == telemetry);
+  return 0;
+}
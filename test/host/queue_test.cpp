@@ -0,0 +1,62 @@
+// build flags: -DMT_TX_QUEUE_LEN=16 -DMT_TX_POOL_SIZE=1024
+// The TX queue, sized as for a board that sends in bursts, should take a burst of texts without
+// turning any away, keep them moving against a radio that never sends QueueStatus (as older
+// firmware doesn't), and hold as many packets as the radio's own queue when they're short.
+#include "radio.h"
+
+#define BURST 10
+
+static int sent = 0, refused = 0;
+
+static void send_texts(int n) {
+  for (int i = 0; i < n; i++) {
+    char text[64];
+    snprintf(text, sizeof(text), "Text number %d, long enough to be a real message", sent + refused);
+    if (mt_send_text(text)) sent++; else refused++;
+  }
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  mt_tx_stats_t tx;
+
+  // A radio that never answers: the burst is written straight away, and once those packets have
+  // gone unanswered, everything after them is written as soon as it's sent
+  send_texts(BURST);
+  CHECK(sent == BURST && refused == 0);
+  CHECK(radio_received().size() == BURST);
+  stub_millis += 2000;
+  mt_poll(millis(), NULL, NULL);
+  mt_get_tx_stats(&tx);
+  CHECK(tx.depth == 0);
+  for (int i = 0; i < 4 * BURST; i++) {
+    send_texts(1);
+    CHECK(radio_received().size() == 1);
+    stub_millis += 100;
+    mt_poll(millis(), NULL, NULL);
+  }
+  mt_get_tx_stats(&tx);
+  printf("silent radio: %d texts, %d refused\n", sent, refused);
+  CHECK(sent == 5 * BURST && refused == 0 && tx.depth == 0);
+
+  // Once the radio does speak up, it's listened to. Here it's full, so the queue fills up with
+  // short packets: as many as the radio's own queue holds, and no more.
+  send_texts(1);
+  std::vector<meshtastic_ToRadio> written = radio_received();
+  CHECK(written.size() == 1);
+  radio_send(radio_queue_status(written[0].packet.id, 0));
+  mt_poll(millis(), NULL, NULL);
+  int queued = 0;
+  mt_bytes_t payload = {(const uint8_t *)"ok", 2};
+  while (mt_send_data(meshtastic_PortNum_TEXT_MESSAGE_APP, payload)) queued++;
+  mt_get_tx_stats(&tx);
+  printf("radio full: %d short packets waiting\n", queued);
+  CHECK(queued == 16 && tx.depth == 16 && tx.dropped == 1);
+  CHECK(radio_received().size() == 0);
+
+  // When it has room again they all go
+  radio_send(radio_queue_status(0, 16));
+  mt_poll(millis(), NULL, NULL);
+  CHECK(radio_received().size() == 16);
+  return 0;
+}
@@ -0,0 +1,78 @@
+// The radio's end of the serial link, for the host tests and benchmarks. Frames the library is to
+// receive go into serial->in; frames it sends are picked out of serial->out.
+#ifndef RADIO_H
+#define RADIO_H
+
+#include <vector>
+#include <string>
+#include "Meshtastic.h"
+#include <SoftwareSerial.h>
+
+extern SoftwareSerial * serial;  // mt_serial.cpp's link to the radio
+
+#define CHECK(cond) do { \
+    if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } \
+  } while (0)
+
+// A FromRadio with its header, as the radio sends it
+static inline std::string radio_frame(const meshtastic_FromRadio & f) {
+  uint8_t buf[4 + meshtastic_FromRadio_size];
+  pb_ostream_t stream = pb_ostream_from_buffer(buf + 4, meshtastic_FromRadio_size);
+  CHECK(pb_encode(&stream, meshtastic_FromRadio_fields, &f));
+  buf[0] = 0x94;
+  buf[1] = 0xc3;
+  buf[2] = stream.bytes_written >> 8;
+  buf[3] = stream.bytes_written & 0xff;
+  return std::string((const char *)buf, 4 + stream.bytes_written);
+}
+
+static inline void radio_write(const std::string & bytes) {
+  serial->in.insert(serial->in.end(), bytes.begin(), bytes.end());
+}
+
+static inline void radio_send(const meshtastic_FromRadio & f) {
+  radio_write(radio_frame(f));
+}
+
+static inline meshtastic_FromRadio radio_text(uint32_t from, uint32_t to, const char * text) {
+  meshtastic_FromRadio f = meshtastic_FromRadio_init_zero;
+  f.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  f.packet.from = from;
+  f.packet.to = to;
+  f.packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  f.packet.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+  f.packet.decoded.payload.size = strlen(text);
+  memcpy(f.packet.decoded.payload.bytes, text, f.packet.decoded.payload.size);
+  return f;
+}
+
+static inline meshtastic_FromRadio radio_queue_status(uint32_t packet_id, uint16_t free, int32_t res = 0) {
+  meshtastic_FromRadio f = meshtastic_FromRadio_init_zero;
+  f.which_payload_variant = meshtastic_FromRadio_queueStatus_tag;
+  f.queueStatus.res = res;
+  f.queueStatus.free = free;
+  f.queueStatus.maxlen = 16;
+  f.queueStatus.mesh_packet_id = packet_id;
+  return f;
+}
+
+// Every complete ToRadio the library has written since the last call
+static inline std::vector<meshtastic_ToRadio> radio_received() {
+  std::vector<meshtastic_ToRadio> frames;
+  std::string & out = serial->out;
+  size_t pos = 0;
+  while (out.size() - pos >= 4) {
+    CHECK((uint8_t)out[pos] == 0x94 && (uint8_t)out[pos + 1] == 0xc3);
+    size_t len = (uint8_t)out[pos + 2] << 8 | (uint8_t)out[pos + 3];
+    if (out.size() - pos < 4 + len) break;
+    meshtastic_ToRadio t = meshtastic_ToRadio_init_zero;
+    pb_istream_t stream = pb_istream_from_buffer((const uint8_t *)out.data() + pos + 4, len);
+    CHECK(pb_decode(&stream, meshtastic_ToRadio_fields, &t));
+    frames.push_back(t);
+    pos += 4 + len;
+  }
+  out.erase(0, pos);
+  return frames;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Build the library on this host against the stubs in stub/, then run the tests (under
+# AddressSanitizer) and the benchmarks.
+#
+#   test/host/run.sh            tests and benchmarks
+#   test/host/run.sh test       just the tests
+#   test/host/run.sh bench      just the benchmarks
+#
+# Extra compiler flags can be given in CXXFLAGS, e.g. CXXFLAGS=-DMT_STREAMING_DECODE.
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+src=$here/../../src
+out=${OUT:-$here/build}
+what=${1:-all}
+mkdir -p "$out"
+
+# Each program is built with the whole library, since a program can ask for build flags that change
+# it with a "// build flags:" line
+build() {
+  prog=$1; shift
+  flags=$(sed -n 's|^// build flags: ||p' "$here/$prog.cpp")
+  g++ -std=gnu++11 -I"$here/stub" -I"$here" -I"$src" -w "$@" $flags $CXXFLAGS \
+    "$src"/*.cpp "$here"/stub/stub.cpp "$here/$prog.cpp" \
+    -x c "$src"/*.c "$src"/meshtastic/*.c -x none -o "$out/$prog" -lm
+}
+
+status=0
+if [ "$what" != bench ]; then
+  for t in "$here"/*_test.cpp; do
+    name=$(basename "$t" .cpp)
+    build "$name" -g -O1 -fsanitize=address,undefined -fno-omit-frame-pointer
+    if "$out/$name"; then echo "PASS $name"; else echo "FAIL $name"; status=1; fi
+  done
+fi
+if [ "$what" != test ]; then
+  for b in "$here"/*_bench.cpp; do
+    [ -e "$b" ] || continue
+    name=$(basename "$b" .cpp)
+    build "$name" -O2
+    echo "== $name"
+    "$out/$name"
+  done
+fi
+exit $status
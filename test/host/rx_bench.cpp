@@ -0,0 +1,80 @@
+// How much copying receiving costs per frame, on a mix of frame sizes like a busy mesh sends. The
+// frames arrive 64 bytes at a time, as if from a UART FIFO.
+//
+// For comparison, the old receive path is modelled alongside: a linear buffer that's shifted down
+// with memmove (by all of PB_BUFSIZE - 4 - payload_len bytes) after every frame. Both are fed the
+// same bytes in the same pieces. Time isn't compared, as the library does more with each frame
+// than the model (peeking, callbacks, the node table).
+#include "mesh_mix.h"
+
+#define FRAMES 20000
+#define CHUNK 64
+#define LINEAR_BUFSIZE 512
+
+static uint32_t frames_seen = 0;
+
+static void on_text(uint32_t from, uint32_t to, uint8_t channel, const char * text) {}
+
+static void feed(const std::string & all, size_t * pos) {
+  size_t n = all.size() - *pos < CHUNK ? all.size() - *pos : CHUNK;
+  radio_write(all.substr(*pos, n));
+  *pos += n;
+}
+
+// The old path, much as it was
+static pb_byte_t linear_buf[LINEAR_BUFSIZE + 4];
+static size_t linear_size = 0;
+static meshtastic_FromRadio linear_frame;
+static uint64_t linear_moved = 0;
+
+static void linear_loop() {
+  size_t space_left = LINEAR_BUFSIZE - linear_size;
+  while (space_left > 0 && serial->available()) {
+    linear_buf[linear_size++] = serial->read();
+    space_left--;
+  }
+  if (linear_size < 4) return;
+  size_t payload_len = linear_buf[2] << 8 | linear_buf[3];
+  if (payload_len + 4 > linear_size) return;
+  pb_istream_t stream = pb_istream_from_buffer(linear_buf + 4, payload_len);
+  memset(&linear_frame, 0, sizeof(linear_frame));
+  CHECK(pb_decode(&stream, meshtastic_FromRadio_fields, &linear_frame));
+  frames_seen++;
+  memmove(linear_buf, linear_buf + 4 + payload_len, LINEAR_BUFSIZE - 4 - payload_len);
+  linear_moved += LINEAR_BUFSIZE - 4 - payload_len;
+  linear_size -= 4 + payload_len;
+}
+
+int main() {
+  std::vector<std::string> frames = mesh_mix(FRAMES);
+  std::string all;
+  for (const std::string & f : frames) all += f;
+
+  mt_serial_init(1, 2);
+  set_text_message_callback(on_text);
+
+  size_t pos = 0;
+  frames_seen = 0;
+  while (pos < all.size() || serial->available()) {
+    if (pos < all.size()) feed(all, &pos);
+    linear_loop();
+  }
+  while (frames_seen < FRAMES) linear_loop();
+
+  pos = 0;
+  uint32_t handled_total = 0;
+  while (pos < all.size() || serial->available()) {
+    if (pos < all.size()) feed(all, &pos);
+    uint16_t handled;
+    mt_poll(millis(), NULL, &handled);
+    handled_total += handled;
+  }
+  CHECK(handled_total == FRAMES);
+
+  printf("%d frames, %.1f bytes each on average\n\n", FRAMES, (double)all.size() / FRAMES);
+  printf("                   bytes copied per frame\n");
+  printf("                   in from UART   shifted down\n");
+  printf("linear + memmove   %12.1f   %12.1f\n", (double)all.size() / FRAMES, (double)linear_moved / FRAMES);
+  printf("ring buffer        %12.1f   %12.1f\n", (double)all.size() / FRAMES, 0.0);
+  return 0;
+}
@@ -0,0 +1,67 @@
+// build flags: -DMT_NODEDB_SIZE=32
+// A snapshot saved and loaded again gives back the same node table, with each device metric kept or
+// left out on its own, and loading it neither reports the nodes to the app nor tells the airtime
+// governor anything.
+#include "radio.h"
+#include "mt_internals.h"
+
+static int reported = 0;
+
+static void on_node(mt_node_t * node, mt_nr_progress_t progress) {
+  if (node != NULL) reported++;
+}
+
+static void put(uint32_t num, uint8_t battery_level, float voltage, float channel_utilization, float air_util_tx) {
+  mt_node_t node;
+  memset(&node, 0, sizeof(node));
+  node.node_num = num;
+  node.has_user = true;
+  snprintf(node.user_id, sizeof(node.user_id), "!%08lx", (unsigned long)num);
+  snprintf(node.long_name, sizeof(node.long_name), "Node %lu", (unsigned long)num);
+  strncpy(node.short_name, "N", sizeof(node.short_name));
+  node.latitude = node.longitude = NAN;
+  node.battery_level = battery_level;
+  node.voltage = voltage;
+  node.channel_utilization = channel_utilization;
+  node.air_util_tx = air_util_tx;
+  node.snr = 6.5;
+  node.last_heard_from = 1000 + num;
+  mt_nodedb_put(&node);
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  my_node_num = 0x1234;
+  put(0x1234, 0, NAN, 80, 10);  // Ours, with utilisation but no battery
+  put(0x5678, 90, 3.7, NAN, NAN);  // Battery only
+  put(0x9abc, 0, NAN, NAN, NAN);  // No metrics at all
+
+  uint8_t buf[1024];
+  pb_ostream_t out = pb_ostream_from_buffer(buf, sizeof(buf));
+  CHECK(mt_snapshot_save(&out));
+  printf("snapshot of %u nodes: %u bytes\n", (unsigned)mt_nodedb_count(), (unsigned)out.bytes_written);
+
+  mt_nodedb_clear();
+  my_node_num = 0;
+  CHECK(mt_request_node_report(on_node));
+  pb_istream_t in = pb_istream_from_buffer(buf, out.bytes_written);
+  CHECK(mt_snapshot_load(&in));
+  CHECK(my_node_num == 0x1234 && mt_nodedb_count() == 3);
+  CHECK(reported == 0);
+  mt_airtime_t airtime;
+  mt_get_airtime(&airtime);
+  CHECK(isnan(airtime.channel_utilization));
+
+  mt_node_t node;
+  CHECK(mt_nodedb_find(0x1234, &node));
+  CHECK(node.is_mine && strcmp(node.long_name, "Node 4660") == 0 && node.last_heard_from == 1000 + 0x1234);
+  CHECK(node.battery_level == 0 && isnan(node.voltage));
+  CHECK(fabsf(node.channel_utilization - 80) < 0.1 && fabsf(node.air_util_tx - 10) < 0.1);
+  CHECK(mt_nodedb_find(0x5678, &node));
+  CHECK(node.battery_level == 90 && fabsf(node.voltage - 3.7) < 0.01);
+  CHECK(isnan(node.channel_utilization) && isnan(node.air_util_tx));
+  CHECK(mt_nodedb_find(0x9abc, &node));
+  CHECK(isnan(node.voltage) && isnan(node.channel_utilization) && isnan(node.latitude));
+  CHECK(fabsf(node.snr - 6.5) < 0.1);
+  return 0;
+}
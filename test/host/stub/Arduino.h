@@ -0,0 +1,58 @@
+// Just enough of the Arduino core to build the library on a host, for the tests and benchmarks
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <deque>
+#include <string>
+
+// The clock only moves when a test moves it
+extern uint32_t stub_millis;
+inline uint32_t millis() { return stub_millis; }
+inline uint32_t micros() { return stub_millis * 1000; }
+inline void delay(uint32_t ms) { stub_millis += ms; }
+inline long random(long max) { return rand() % max; }
+inline void randomSeed(unsigned long seed) { srand(seed); }
+
+// Everything written is kept in out
+class Print {
+public:
+  std::string out;
+  int write_space = 1 << 20;  // What availableForWrite() says
+  size_t write(uint8_t c) { out.push_back((char)c); return 1; }
+  size_t write(const uint8_t * buf, size_t n) { out.append((const char *)buf, n); return n; }
+  size_t write(const char * buf, size_t n) { out.append(buf, n); return n; }
+  int availableForWrite() { return write_space; }
+  size_t print(const char * s) { out += s; return strlen(s); }
+  size_t print(char * s) { return print((const char *)s); }
+  template <typename T> size_t print(T v) { std::string s = std::to_string(v); out += s; return s.size(); }
+  size_t print(long v, int) { return print(v); }
+  template <typename T> size_t println(T v) { size_t n = print(v); out += "\r\n"; return n + 2; }
+  size_t println() { out += "\r\n"; return 2; }
+  void flush() {}
+};
+
+// Bytes for the library to read are put in in
+class Stream : public Print {
+public:
+  std::deque<uint8_t> in;
+  int available() { return in.size(); }
+  int read() { if (in.empty()) return -1; int c = in.front(); in.pop_front(); return c; }
+  int peek() { return in.empty() ? -1 : in.front(); }
+  size_t readBytes(char * buf, size_t n) { size_t i = 0; while (i < n && !in.empty()) buf[i++] = read(); return i; }
+  size_t readBytes(uint8_t * buf, size_t n) { return readBytes((char *)buf, n); }
+  void setTimeout(unsigned long) {}
+  void begin(unsigned long) {}
+  operator bool() { return true; }
+};
+
+typedef Stream HardwareSerial;
+extern Stream Serial;
+
+#endif
@@ -0,0 +1,4 @@
+#include "Arduino.h"
+
+uint32_t stub_millis = 0;
+Stream Serial;
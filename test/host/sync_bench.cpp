@@ -0,0 +1,167 @@
+// How soon each sync mode gets an app going: when MT_HAVE_MINIMAL and the config arrive, and when
+// the sync is done, with a radio that has 300 nodes in its DB, at 9600 baud. The radio here answers
+// want_config with a synthetic dump, in the order the firmware's PhoneAPI sends it: our own info,
+// our own node, metadata, channels, config, module config, the other nodes, then the ID back.
+#include "radio.h"
+
+#define NODES 300
+#define MY_NODE_NUM 0x1234
+#define BYTES_PER_SEC 960  // 9600 baud, 8N1
+
+extern uint8_t sync_state;
+extern uint8_t channels_seen;
+
+static std::string node_frame(uint32_t num) {
+  meshtastic_FromRadio f = meshtastic_FromRadio_init_zero;
+  f.which_payload_variant = meshtastic_FromRadio_node_info_tag;
+  meshtastic_NodeInfo & n = f.node_info;
+  n.num = num;
+  n.has_user = true;
+  snprintf(n.user.id, sizeof(n.user.id), "!%08x", (unsigned)num);
+  snprintf(n.user.long_name, sizeof(n.user.long_name), "Meshtastic %04x", (unsigned)(num & 0xffff));
+  snprintf(n.user.short_name, sizeof(n.user.short_name), "%04x", (unsigned)(num & 0xffff));
+  n.user.hw_model = meshtastic_HardwareModel_TBEAM;
+  n.user.public_key.size = 32;
+  memset(n.user.public_key.bytes, num & 0xff, 32);
+  n.has_position = true;
+  n.position.has_latitude_i = n.position.has_longitude_i = n.position.has_altitude = true;
+  n.position.latitude_i = 515000000 + num * 97;
+  n.position.longitude_i = -1200000 + num * 89;
+  n.position.altitude = 40;
+  n.position.time = 1700000000;
+  n.snr = 6.25;
+  n.last_heard = 1700000000 + num;
+  n.has_device_metrics = true;
+  n.device_metrics.has_battery_level = n.device_metrics.has_voltage = true;
+  n.device_metrics.has_channel_utilization = n.device_metrics.has_air_util_tx = true;
+  n.device_metrics.battery_level = 80;
+  n.device_metrics.voltage = 3.9f;
+  n.device_metrics.channel_utilization = 12.5f;
+  n.device_metrics.air_util_tx = 1.5f;
+  n.device_metrics.has_uptime_seconds = true;
+  n.device_metrics.uptime_seconds = 86400 + num;
+  n.hops_away = num % 4;
+  return radio_frame(f);
+}
+
+// What the radio sends back for want_config_id
+static std::string dump(uint32_t id) {
+  bool config = id != 69421, nodes = id != 69420;  // The IDs the firmware treats specially
+  std::string out;
+  meshtastic_FromRadio f = meshtastic_FromRadio_init_zero;
+  if (config) {
+    f.which_payload_variant = meshtastic_FromRadio_my_info_tag;
+    f.my_info.my_node_num = MY_NODE_NUM;
+    f.my_info.reboot_count = 3;
+    f.my_info.min_app_version = 30200;
+    out += radio_frame(f);
+  }
+  out += node_frame(MY_NODE_NUM);
+  if (config) {
+    f = meshtastic_FromRadio_init_zero;
+    f.which_payload_variant = meshtastic_FromRadio_metadata_tag;
+    strcpy(f.metadata.firmware_version, "2.5.15.79da236");
+    f.metadata.device_state_version = 23;
+    f.metadata.hasBluetooth = true;
+    f.metadata.hw_model = meshtastic_HardwareModel_TBEAM;
+    out += radio_frame(f);
+    for (int i = 0; i < MT_MAX_CHANNELS; i++) {
+      f = meshtastic_FromRadio_init_zero;
+      f.which_payload_variant = meshtastic_FromRadio_channel_tag;
+      f.channel.index = i;
+      f.channel.role = i == 0 ? meshtastic_Channel_Role_PRIMARY : meshtastic_Channel_Role_DISABLED;
+      f.channel.has_settings = true;
+      if (i == 0) {
+        f.channel.settings.psk.size = 1;
+        f.channel.settings.psk.bytes[0] = 1;
+      }
+      out += radio_frame(f);
+    }
+    for (pb_size_t tag = meshtastic_Config_device_tag; tag <= meshtastic_Config_security_tag; tag++) {
+      f = meshtastic_FromRadio_init_zero;
+      f.which_payload_variant = meshtastic_FromRadio_config_tag;
+      f.config.which_payload_variant = tag;
+      if (tag == meshtastic_Config_lora_tag) {
+        f.config.payload_variant.lora.use_preset = true;
+        f.config.payload_variant.lora.region = meshtastic_Config_LoRaConfig_RegionCode_EU_868;
+        f.config.payload_variant.lora.hop_limit = 3;
+        f.config.payload_variant.lora.tx_enabled = true;
+      }
+      out += radio_frame(f);
+    }
+    for (pb_size_t tag = meshtastic_ModuleConfig_mqtt_tag; tag <= meshtastic_ModuleConfig_paxcounter_tag; tag++) {
+      f = meshtastic_FromRadio_init_zero;
+      f.which_payload_variant = meshtastic_FromRadio_moduleConfig_tag;
+      f.moduleConfig.which_payload_variant = tag;
+      out += radio_frame(f);
+    }
+  }
+  if (nodes) {
+    for (uint32_t i = 1; i <= NODES - 1; i++) out += node_frame(0x10000 + i);
+  }
+  f = meshtastic_FromRadio_init_zero;
+  f.which_payload_variant = meshtastic_FromRadio_config_complete_id_tag;
+  f.config_complete_id = id;
+  out += radio_frame(f);
+  return out;
+}
+
+static uint32_t done_at;
+
+static void on_node(mt_node_t * node, mt_nr_progress_t progress) {
+  if (node == NULL && progress == MT_NR_DONE) done_at = millis();
+}
+
+static void ms(char * buf, uint32_t at, uint32_t start) {
+  if (at == 0) snprintf(buf, 16, "-");
+  else if (at - start < 1000) snprintf(buf, 16, "%lu ms", (unsigned long)(at - start));
+  else snprintf(buf, 16, "%.2f s", (at - start) / 1000.0);
+}
+
+static void run(const char * name, mt_sync_mode_t mode) {
+  sync_state = 0;
+  channels_seen = 0;
+  serial->in.clear();
+  serial->out.clear();
+  done_at = 0;
+  uint32_t start = millis(), minimal_at = 0, config_at = 0;
+  std::string pending;
+  size_t sent = 0, total = 0;
+  CHECK(mt_request_sync(mode, on_node));
+
+  // The radio answers each want_config as it sees it, and sends at the line rate
+  while (done_at == 0 && millis() - start < 600000) {
+    for (const meshtastic_ToRadio & t : radio_received()) {
+      if (t.which_payload_variant == meshtastic_ToRadio_want_config_id_tag) pending += dump(t.want_config_id);
+    }
+    serial->out.clear();
+    stub_millis++;
+    size_t due = (uint64_t)(millis() - start) * BYTES_PER_SEC / 1000;
+    if (due > total + pending.size() - sent) due = total + pending.size() - sent;
+    if (due > total) {
+      radio_write(pending.substr(sent, due - total));
+      sent += due - total;
+      total = due;
+    }
+    mt_poll(millis(), NULL, NULL);
+    if (minimal_at == 0 && (mt_sync_state() & MT_HAVE_MINIMAL) == MT_HAVE_MINIMAL) minimal_at = millis();
+    if (config_at == 0 && (mt_sync_state() & MT_HAVE_CONFIG)) config_at = millis();
+  }
+  CHECK(done_at != 0);
+  char minimal[16], config[16], done[16];
+  ms(minimal, minimal_at, start);
+  ms(config, config_at, start);
+  ms(done, done_at, start);
+  printf("%-6s  %-9s  %-9s  %-9s  %6lu\n", name, minimal, config, done, (unsigned long)total);
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  printf("%u nodes of %u bytes each, at %u bytes/sec\n\n", NODES, (unsigned)node_frame(0x10001).size(), BYTES_PER_SEC);
+  printf("mode    minimal    config     done        bytes\n");
+  run("FULL", MT_SYNC_FULL);
+  run("CONFIG", MT_SYNC_CONFIG);
+  run("NODES", MT_SYNC_NODES);
+  run("STAGED", MT_SYNC_STAGED);
+  return 0;
+}
@@ -0,0 +1,99 @@
+// Bytes on air and CPU time per message for unishox2 on the compressed text port, over texts like
+// people send on a mesh. Each is sent with and without the codec, and the frames the library writes
+// are measured. unishox2 isn't kept in the tree, so no figures are either; to get them:
+//
+//   bin/fetch-unishox2.sh && test/host/run.sh bench
+//
+// CI does the same in its host-benchmarks job, and puts the output in the job's summary. The
+// codec hook itself is tested, with a stand-in codec, by codec_test.
+#include "mesh_mix.h"
+
+#if defined(__has_include) && __has_include("unishox2.h")
+extern "C" {
+#include "unishox2.h"
+}
+
+#define ROUNDS 2000
+
+static const char * texts[] = {
+  "ok",
+  "On my way",
+  "Heading to the trailhead, back by six",
+  "Anyone copy? Testing the new antenna on the roof",
+  "Battery at 40%, switching to power saving for the night",
+  "Meet at the north gate at 14:30, bring the spare radio",
+  "Power is out on Elm St, crews say about 2 hours",
+  "Can someone relay to base camp: all good, staying put until the weather clears",
+  "https://meshtastic.org/docs/configuration/radio/lora/",
+  "Grüße aus München! Wie ist der Empfang bei euch?",
+};
+#define TEXTS (sizeof(texts) / sizeof(texts[0]))
+
+static size_t frame_bytes(const char * text) {
+  CHECK(mt_send_text(text));
+  mt_poll(millis(), NULL, NULL);
+  std::vector<meshtastic_ToRadio> written;
+  for (const meshtastic_ToRadio & t : radio_received()) {
+    if (t.which_payload_variant == meshtastic_ToRadio_packet_tag) written.push_back(t);
+  }
+  CHECK(written.size() == 1);
+  radio_send(radio_queue_status(written[0].packet.id, 16));
+  mt_poll(millis(), NULL, NULL);
+  stub_millis += 60000;  // Keep the airtime governor out of it
+  pb_ostream_t sizing = PB_OSTREAM_SIZING;
+  CHECK(pb_encode(&sizing, meshtastic_ToRadio_fields, &written[0]));
+  return sizing.bytes_written;
+}
+
+static size_t u_compress(const char * text, size_t len, uint8_t * out, size_t out_size) {
+  int n = unishox2_compress(text, len, UNISHOX_API_OUT_AND_LEN((char *)out, out_size), USX_PSET_DFLT);
+  return n > 0 && (size_t)n <= out_size ? n : 0;
+}
+
+static size_t u_decompress(const uint8_t * data, size_t len, char * out, size_t out_size) {
+  int n = unishox2_decompress((const char *)data, len, UNISHOX_API_OUT_AND_LEN(out, out_size), USX_PSET_DFLT);
+  return n > 0 && (size_t)n <= out_size ? n : 0;
+}
+
+int main() {
+  mt_serial_init(1, 2);
+  size_t plain_total = 0, packed_total = 0;
+  uint32_t plain_ms = 0, packed_ms = 0;
+  double compress_us = 0, decompress_us = 0;
+
+  printf("text bytes   frame plain   frame packed\n");
+  for (size_t i = 0; i < TEXTS; i++) {
+    mt_set_text_codec(NULL, NULL);
+    size_t plain = frame_bytes(texts[i]);
+    mt_set_text_codec(u_compress, u_decompress);
+    size_t packed = frame_bytes(texts[i]);
+    printf("%10zu   %11zu   %12zu\n", strlen(texts[i]), plain, packed);
+    plain_total += plain;
+    packed_total += packed;
+    plain_ms += mt_airtime_ms(plain);
+    packed_ms += mt_airtime_ms(packed);
+
+    uint8_t out[meshtastic_Constants_DATA_PAYLOAD_LEN];
+    char back[meshtastic_Constants_DATA_PAYLOAD_LEN + 1];
+    size_t len = 0, back_len = 0;
+    double start = seconds();
+    for (int r = 0; r < ROUNDS; r++) len = u_compress(texts[i], strlen(texts[i]), out, sizeof(out));
+    compress_us += (seconds() - start) * 1e6 / ROUNDS;
+    start = seconds();
+    for (int r = 0; r < ROUNDS; r++) back_len = u_decompress(out, len, back, sizeof(back) - 1);
+    decompress_us += (seconds() - start) * 1e6 / ROUNDS;
+    CHECK(back_len == strlen(texts[i]) && memcmp(back, texts[i], back_len) == 0);
+  }
+
+  printf("\nframe bytes: %zu plain, %zu with unishox2 (%.0f%%)\n", plain_total, packed_total,
+         100.0 * packed_total / plain_total);
+  printf("airtime: %lu ms plain, %lu ms with unishox2\n", (unsigned long)plain_ms, (unsigned long)packed_ms);
+  printf("per message: %.2f us to compress, %.2f us to decompress\n", compress_us / TEXTS, decompress_us / TEXTS);
+  return 0;
+}
+#else
+int main() {
+  printf("unishox2 isn't in src/; run bin/fetch-unishox2.sh to vendor it\n");
+  return 0;
+}
+#endif